@@ -11,35 +11,466 @@
 *    using the LS7336 Quadrature Encode chip.
 ***********************************************************/
 #include"7366rDriver.h"
+#include "Timing.h"
+#if LS7366R_SPIDEV
+#include "dev_hardware_SPI.h"
+#endif
 
 unsigned char setMDR0[] = {WRITE_MODE0, FOURX_COUNT};
 unsigned char setMDR1[] = {WRITE_MODE1, FOURBYTE_COUNTER};
 unsigned char clearStatus[] = {CLEAR_STATUS};
 unsigned char clearCounter[] = {CLEAR_COUNTER};
 unsigned char readCounterMsg[] = { READ_COUNTER, 0, 0, 0, 0};
+unsigned char loadOTRMsg[] = {LOAD_OTR};
+unsigned char readOTRMsg[] = { READ_OTR, 0, 0, 0, 0};
+unsigned char readStatusMsg[] = {READ_STATUS, 0};
 unsigned char BYTE_MODE[] = {ONEBYTE_COUNTER, TWOBYTE_COUNTER, 
                              THREEBYTE_COUNTER, FOURBYTE_COUNTER};
+
+// one entry per chip select, the encoder board has two chips
+typedef struct {
+    int ChipEnable;
+    char *device;
+    int bytes;          // counter width, 1 to 4 bytes
+    long long count;    // unwrapped count, kept if a read fails
+    long long offset;   // unwrapped count when the chip's counter was last cleared
+    unsigned long long goodNs;  // time of the last good read
+    double maxRate;     // fastest the counter can move (counts/s), 0 if unknown
+#if LS7366R_SPIDEV
+    HARDWARE_SPI_DEV dev;
+#endif
+} LS7336R_CHIP;
+
+static LS7336R_CHIP chips[] = {
+    { .ChipEnable = SPI0_CE0, .device = "/dev/spidev0.0", .bytes = 4 },
+    { .ChipEnable = SPI0_CE1, .device = "/dev/spidev0.1", .bytes = 4 },
+};
+#define NUM_CHIPS (sizeof(chips) / sizeof(chips[0]))
+
+static LS7336R_STATS stats;
+
+
+static void recordRead (unsigned long long elapsed)
+    {
+    stats.reads++;
+    stats.last_ns = elapsed;
+    stats.total_ns += elapsed;
+    if (elapsed > stats.max_ns)
+        {
+        stats.max_ns = elapsed;
+        }
+    }
+
+// counter bytes follow the command byte, most significant first
+static unsigned rawCount (const unsigned char *dataFromChip, int bytes)
+    {
+    unsigned raw = 0;
+    for (int i = 1; i <= bytes; i++)
+        {
+        raw = (raw << 8) | dataFromChip[i];
+        }
+    return (raw);
+    }
+
+static LS7336R_CHIP *findChip (int ChipEnable)
+    {
+    for (unsigned i = 0; i < NUM_CHIPS; i++)
+        {
+        if (chips[i].ChipEnable == ChipEnable)
+            {
+            return (&chips[i]);
+            }
+        }
+    return (NULL);
+    }
+
+/*************************************************************************
+ *   LS7336R Transfer
+ *
+ *  Sends count bytes to the chip and reads count bytes back, through
+ *  whichever SPI backend was selected at compile time.
+ *
+ *  Return:
+ *      Number of bytes transferred if success, otherwise negative
+ *************************************************************************/
+
+static int xferLS7336R (LS7336R_CHIP *chip, unsigned char *txBuf, unsigned char *rxBuf, unsigned count)
+    {
+#if LS7366R_SPIDEV
+    HARDWARE_SPI_XFER xfer = { txBuf, rxBuf, count, 0 };
+    if (DEV_HARDWARE_SPI_devTransfer(&chip->dev, &xfer, 1) < 0)
+        {
+        return (-1);
+        }
+    return (count);
+#else
+    return (bbSPIXfer(chip->ChipEnable, (char *)txBuf, (char *)rxBuf, count));
+#endif
+    }
+
+/*************************************************************************
+ *   LS7336R Transfer Several Commands
+ *
+ *  Sends several commands to one chip, releasing chip select between
+ *  each. With the spidev backend they all go out in one ioctl.
+ *
+ *  Return:
+ *      0 if success, otherwise negative
+ *************************************************************************/
+
+#define MAX_COMMANDS 4
+
+typedef struct {
+    unsigned char *txBuf;
+    unsigned char *rxBuf;
+    unsigned count;
+} LS7336R_COMMAND;
+
+static int xferLS7336RCommands (LS7336R_CHIP *chip, LS7336R_COMMAND *commands, int num)
+    {
+#if LS7366R_SPIDEV
+    HARDWARE_SPI_XFER xfers[MAX_COMMANDS];
+    for (int i = 0; i < num; i++)
+        {
+        xfers[i].tx_buf = commands[i].txBuf;
+        xfers[i].rx_buf = commands[i].rxBuf;
+        xfers[i].len = commands[i].count;
+        // chip select must go high to end each command
+        xfers[i].cs_change = (i < num - 1);
+        }
+    return (DEV_HARDWARE_SPI_devTransfer(&chip->dev, xfers, num) < 0 ? -1 : 0);
+#else
+    for (int i = 0; i < num; i++)
+        {
+        if (xferLS7336R(chip, commands[i].txBuf, commands[i].rxBuf, commands[i].count) < 0)
+            {
+            return (-1);
+            }
+        }
+    return (0);
+#endif
+    }
+
+/*************************************************************************
+ *   LS7336R Widen Counter
+ *
+ *  Switches a narrow counter to 4 byte mode while sampling, keeping the
+ *  unwrapped count. The counter is cleared first and the count at that
+ *  moment becomes the offset, so only counts made during the two short
+ *  transfers since the last read are lost. If MDR1 cannot be written the
+ *  chip stays narrow, which is still consistent with the new offset.
+ *************************************************************************/
+
+static void widenLS7336RCounter (LS7336R_CHIP *chip)
+    {
+    unsigned char setWidth[] = {WRITE_MODE1, FOURBYTE_COUNTER};
+    unsigned char dataFromChip[20];
+
+    if (xferLS7336R(chip, clearCounter, dataFromChip, 1) < 0)
+        {
+        return;
+        }
+    chip->offset = chip->count;
+    if (xferLS7336R(chip, setWidth, dataFromChip, 2) >= 0)
+        {
+        chip->bytes = 4;
+        stats.widened++;
+        }
+    }
+
+/*************************************************************************
+ *   LS7336R Update Count
+ *
+ *  Unwraps a good read into the chip's count. The time since the last
+ *  good read, including any failed reads in between, bounds how far the
+ *  counter could have moved. Past half the range the unwrap is ambiguous
+ *  and is counted as such; past a quarter the read is still right but
+ *  the next one may not be, so the counter is widened to 4 bytes.
+ *************************************************************************/
+
+static long long updateLS7336RCount (LS7336R_CHIP *chip, unsigned raw, unsigned long long nowNs)
+    {
+    double range = (double)(1ull << (8 * chip->bytes));
+    double moved = 0.0;
+
+    if (chip->goodNs != 0)
+        {
+        moved = chip->maxRate * (double)(nowNs - chip->goodNs) / TIMING_NS_PER_S;
+        }
+    if (moved >= range / 2.0)
+        {
+        stats.ambiguous++;
+        }
+    chip->count = chip->offset + unwrapLS7336RCount(chip->count - chip->offset, raw, chip->bytes);
+    chip->goodNs = nowNs;
+    if (chip->bytes < 4 && moved >= range / 4.0)
+        {
+        widenLS7336RCounter(chip);
+        }
+    return (chip->count);
+    }
+
+/*************************************************************************
+ *   LS7336R Unwrap Count
+ *
+ *  long long unwrapLS7336RCount (long long Previous, unsigned Raw, int Bytes);
+ *
+ *  Parameters:
+ *  	Previous: is the unwrapped count at the previous read
+ *  	Raw: is the counter value just read, Bytes wide
+ *  	Bytes: is the counter width, 1 to 4
+ *
+ *  Return:
+ *      The unwrapped count. The counter is assumed to have moved by less
+ *      than half its range since the previous read, in either direction,
+ *      see chooseLS7336RCounterBytes.
+ *************************************************************************/
+
+long long unwrapLS7336RCount (long long Previous, unsigned Raw, int Bytes)
+	{
+	unsigned long long range = 1ull << (8 * Bytes);
+	unsigned long long mask = range - 1;
+	long long delta = (long long)(((unsigned long long)Raw - (unsigned long long)Previous) & mask);
+
+	if (delta >= (long long)(range / 2))
+	    {
+	    delta -= (long long)range;
+	    }
+	return (Previous + delta);
+	}
+
+/*************************************************************************
+ *   LS7336R Choose Counter Width
+ *
+ *  int chooseLS7336RCounterBytes (double SampleHz, double MaxRevsPerSec);
+ *
+ *  Parameters:
+ *  	SampleHz: is the rate the counter will be read at
+ *  	MaxRevsPerSec: is the fastest the wheel can turn
+ *
+ *  Return:
+ *      The smallest counter width, in bytes, which the count can be
+ *      unwrapped from even when LS7366R_MISSED_READS reads in a row are
+ *      late or fail. The wheel must then move less than half the counter
+ *      range in that many sample periods.
+ *************************************************************************/
+
+int chooseLS7336RCounterBytes (double SampleHz, double MaxRevsPerSec)
+	{
+	double maxStep = MaxRevsPerSec * PULSES_PER_REV / SampleHz;
+
+	for (int bytes = 1; bytes < 4; bytes++)
+	    {
+	    if (maxStep * (LS7366R_MISSED_READS + 1) < (double)(1ull << (8 * bytes)) / 2.0)
+	        {
+	        return (bytes);
+	        }
+	    }
+	return (4);
+	}
+
 /*************************************************************************
  *   LS7336R Read Counter
  *
+ *  long long readLS7336RCounter64 (int ChipEnable);
  *  int readLS7336RCounter (int ChipEnable);
  *
  *  Parameters:
  *  	ChipEnable: is the pin number of the chip enable (chip select)
  *
  *  Return:
- *      Integer value (4 byte) of the counter
+ *      The unwrapped 64 bit count, or its low 4 bytes, which match the
+ *      chip's own count in 4 byte mode. Only the counter width is read
+ *      from the chip, so narrower widths make shorter transfers.
+ *      If the read fails the previous count is returned, the counts
+ *      are picked up by the next good read.
  *
  *  Note that initLS7336RChip must be called prior to reading the counter
  *************************************************************************/
  
+long long readLS7336RCounter64 (int ChipEnable)
+	{
+	unsigned char dataFromChip[20];
+    LS7336R_CHIP *chip = findChip(ChipEnable);
+    unsigned long long start;
+
+    if (chip == NULL)
+        {
+        return (0);
+        }
+    start = Timing_NowNs();
+    if (xferLS7336R(chip, readCounterMsg, dataFromChip, 1 + chip->bytes) < 0)
+        {
+        stats.errors++;
+        return (chip->count);
+        }
+    recordRead(Timing_NowNs() - start);
+
+    return (updateLS7336RCount(chip, rawCount(dataFromChip, chip->bytes), start));
+	}
+
 int readLS7336RCounter (int ChipEnable)
 	{
-	char dataFromChip[20];
-    bbSPIXfer(ChipEnable, readCounterMsg, dataFromChip, 5);
-    int result = (((int)dataFromChip[1]) << 24) + (((int)dataFromChip[2]) << 16) + 
-    	                        (((int)dataFromChip[3]) << 8) + ((int)dataFromChip[4]);
-    return (result);
+	return ((int)(unsigned)readLS7336RCounter64(ChipEnable));
+	}
+
+/*************************************************************************
+ *   LS7336R Set Counter Width
+ *
+ *  int setLS7336RCounterBytes (int ChipEnable, int Bytes);
+ *
+ *  Parameters:
+ *  	ChipEnable: is the pin number of the chip enable (chip select)
+ *  	Bytes: is the counter width, 1 to 4
+ *
+ *  Return:
+ *      Integer value 0 if success, otherwise negative
+ *
+ *  Sets MDR1 to the counter width and clears the counter. Call this
+ *  before sampling starts, counts since the last read are lost.
+ *************************************************************************/
+
+int setLS7336RCounterBytes (int ChipEnable, int Bytes)
+	{
+	unsigned char setWidth[] = {WRITE_MODE1, 0};
+	unsigned char dataFromChip[20];
+	LS7336R_CHIP *chip = findChip(ChipEnable);
+	int ret;
+
+	if (chip == NULL || Bytes < 1 || Bytes > 4)
+	    {
+	    return (-1);
+	    }
+	setWidth[1] = BYTE_MODE[Bytes - 1];
+	ret = xferLS7336R(chip, setWidth, dataFromChip, 2);
+	if (ret < 0)
+	    {
+	    return (ret);
+	    }
+	chip->bytes = Bytes;
+	return (clearLS7336RCounter(ChipEnable));
+	}
+
+/*************************************************************************
+ *   LS7336R Set Counter Rate
+ *
+ *  int setLS7336RCounterRate (int ChipEnable, double SampleHz, double MaxRevsPerSec);
+ *
+ *  Parameters:
+ *  	ChipEnable: is the pin number of the chip enable (chip select)
+ *  	SampleHz: is the rate the counter will be read at
+ *  	MaxRevsPerSec: is the fastest the wheel can turn
+ *
+ *  Return:
+ *      Integer value 0 if success, otherwise negative
+ *
+ *  Sets the counter to the width from chooseLS7336RCounterBytes and
+ *  remembers the fastest rate, so reads can tell when too long has
+ *  passed since the last good read. A counter read that late is widened
+ *  to 4 bytes, see updateLS7336RCount.
+ *************************************************************************/
+
+int setLS7336RCounterRate (int ChipEnable, double SampleHz, double MaxRevsPerSec)
+	{
+	LS7336R_CHIP *chip = findChip(ChipEnable);
+	int ret;
+
+	if (chip == NULL)
+	    {
+	    return (-1);
+	    }
+	ret = setLS7336RCounterBytes(ChipEnable, chooseLS7336RCounterBytes(SampleHz, MaxRevsPerSec));
+	if (ret == 0)
+	    {
+	    chip->maxRate = MaxRevsPerSec * PULSES_PER_REV;
+	    }
+	return (ret);
+	}
+
+
+/*************************************************************************
+ *   LS7336R Read Latched Counters
+ *
+ *  int readLS7336RCountersLatched (const int *ChipEnables, int Num,
+ *          LS7336R_READING *Readings, unsigned long long *StampNs,
+ *          unsigned long long *SkewNs);
+ *
+ *  Parameters:
+ *  	ChipEnables: are the chip selects of the chips to read
+ *  	Num: is the number of chips, at most 2
+ *  	Readings: receives the count and status flags of each chip
+ *  	StampNs: receives the monotonic time the counts were latched
+ *  	SkewNs: receives the time between the first and last latch
+ *
+ *  Return:
+ *      0 if success, otherwise negative. Chips which could not be read
+ *      report their previous count.
+ *
+ *  Reading CNTR directly samples each chip at a different time, a whole
+ *  read apart. Instead LOAD_OTR is sent to every chip back to back, which
+ *  copies each counter into its output register within one short
+ *  command, and only then are the output registers and status read.
+ *  The status is cleared after it is read, so CY and BW report whether
+ *  the counter wrapped since the previous call.
+ *************************************************************************/
+
+int readLS7336RCountersLatched (const int *ChipEnables, int Num, LS7336R_READING *Readings,
+                                unsigned long long *StampNs, unsigned long long *SkewNs)
+	{
+	LS7336R_CHIP *chip[NUM_CHIPS];
+	unsigned char dataFromChip[NUM_CHIPS][3][20];
+	unsigned long long latched[NUM_CHIPS];
+	unsigned long long start;
+	int ret = 0;
+
+	if (Num < 1 || Num > (int)NUM_CHIPS)
+	    {
+	    return (-1);
+	    }
+	for (int i = 0; i < Num; i++)
+	    {
+	    chip[i] = findChip(ChipEnables[i]);
+	    if (chip[i] == NULL)
+	        {
+	        return (-1);
+	        }
+	    }
+
+	// latch every counter first, as close together as possible
+	for (int i = 0; i < Num; i++)
+	    {
+	    if (xferLS7336R(chip[i], loadOTRMsg, dataFromChip[i][0], 1) < 0)
+	        {
+	        ret = -1;
+	        }
+	    latched[i] = Timing_NowNs();
+	    }
+	*SkewNs = latched[Num - 1] - latched[0];
+	*StampNs = latched[0] + *SkewNs / 2;
+
+	// then read them out at leisure
+	for (int i = 0; i < Num; i++)
+	    {
+	    LS7336R_COMMAND commands[] = {
+	        { readOTRMsg, dataFromChip[i][0], 1 + chip[i]->bytes },
+	        { readStatusMsg, dataFromChip[i][1], 2 },
+	        { clearStatus, dataFromChip[i][2], 1 },
+	    };
+	    start = Timing_NowNs();
+	    if (xferLS7336RCommands(chip[i], commands, 3) < 0)
+	        {
+	        stats.errors++;
+	        Readings[i].count = chip[i]->count;
+	        Readings[i].status = 0;
+	        ret = -1;
+	        continue;
+	        }
+	    recordRead(Timing_NowNs() - start);
+	    Readings[i].count = updateLS7336RCount(chip[i],
+	        rawCount(dataFromChip[i][0], chip[i]->bytes), latched[i]);
+	    Readings[i].status = dataFromChip[i][1][1];
+	    }
+	return (ret);
 	}
 
 
@@ -62,10 +493,19 @@ int clearLS7336RCounter (int ChipEnable)
     int ret;
     char dataFromChip[20];
     
+    LS7336R_CHIP *chip = findChip(ChipEnable);
+
+    if (chip == NULL)
+        {
+        return (-1);
+        }
     // Clear the counter
-    ret = bbSPIXfer(ChipEnable, clearCounter, dataFromChip, 1);
+    ret = xferLS7336R(chip, clearCounter, (unsigned char *)dataFromChip, 1);
     if (ret >= 0) // xfer succeeded
         {
+        chip->count = 0;
+        chip->offset = 0;
+        chip->goodNs = Timing_NowNs();
         ret = 0;
         }
     return (ret);
@@ -82,32 +522,66 @@ int clearLS7336RCounter (int ChipEnable)
  *  Return:
  *      Integer value 0 if success, otherwise pigpio error number
  *
- *  initLS7336RChip initializes the pigpio SPI interface,
+ *  initLS7336RChip initializes the chip with the default SPI clock,
+ *      see initLS7336RChipSpeed.
+ *************************************************************************/
+ 
+int initLS7336RChip (int ChipEnable)
+	{
+	return (initLS7336RChipSpeed(ChipEnable, LS7366R_SPI_SPEED));
+	}
+
+/*************************************************************************
+ *   LS7336R init with clock speed
+ *
+ *  int initLS7336RChipSpeed (int ChipEnable, unsigned Speed);
+ *
+ *  Parameters:
+ *  	ChipEnable: is the pin number of the chip enable (chip select),
+ *  	            SPI0_CE0 or SPI0_CE1
+ *  	Speed: is the SPI clock in Hz
+ *
+ *  Return:
+ *      Integer value 0 if success, otherwise a negative error number
+ *      (the pigpio error number for the bit-banged backend)
+ *
+ *  initLS7336RChipSpeed opens the SPI interface, either the hardware
+ *      spidev device for the chip select or pigpio bit-banged SPI,
  *      it initializes the LS7336R chip by setting MDR0 to 4x Count Mode,
  *      setting MDR1 to 4 byte counter mode, clearing the status register,
  *      and clearing the counter.
  *************************************************************************/
  
-int initLS7336RChip (int ChipEnable)
+int initLS7336RChipSpeed (int ChipEnable, unsigned Speed)
 	{
 	int ret;
-	char dataFromChip[20];
-	
-    ret = bbSPIOpen(ChipEnable, SPI0_MISO, SPI0_MOSI, SPI0_SCLK, 100000, 0); //open SPI
+	unsigned char dataFromChip[20];
+	LS7336R_CHIP *chip = findChip(ChipEnable);
+
+	if (chip == NULL)
+	    {
+	    return (-1);
+	    }
+#if LS7366R_SPIDEV
+    ret = (DEV_HARDWARE_SPI_devOpen(&chip->dev, chip->device, SPI_MODE0, Speed) < 0) ? -1 : 0;
+#else
+    ret = bbSPIOpen(ChipEnable, SPI0_MISO, SPI0_MOSI, SPI0_SCLK, Speed, 0); //open SPI
+#endif
     if (ret == 0)  // open succeeded
         {
     	usleep (10000);
     	//set MDR0 to 4x counter mode
-        ret = bbSPIXfer(ChipEnable, setMDR0, dataFromChip, 2);  //Set MDR0 
+        ret = xferLS7336R(chip, setMDR0, dataFromChip, 2);  //Set MDR0 
         if (ret >= 0)  //xfer succeeded
             {
             usleep (10000);
             // set MDR1 to 4 byte counter mode
-            ret = bbSPIXfer(ChipEnable, setMDR1, dataFromChip, 2);  //Set MDR1 
+            ret = xferLS7336R(chip, setMDR1, dataFromChip, 2);  //Set MDR1 
             if (ret >= 0)  //xfer succeeded
                 {
+                chip->bytes = 4;
                 // Clear status
-                ret = bbSPIXfer(ChipEnable, clearStatus, dataFromChip, 1);
+                ret = xferLS7336R(chip, clearStatus, dataFromChip, 1);
                 if (ret >= 0)  //xfer succeeded
                     {
                     // Clear the counter
@@ -119,5 +593,25 @@ int initLS7336RChip (int ChipEnable)
         
     return (ret);
 	}	
-	
 
+/*************************************************************************
+ *   LS7336R read timing
+ *
+ *  void getLS7336RStats (LS7336R_STATS *Stats);
+ *  void resetLS7336RStats (void);
+ *
+ *  Time taken by each successful readLS7336RCounter transfer, the
+ *  number of failed reads, reads which came too late to unwrap for
+ *  certain, and counters widened to 4 bytes after a late read. Only
+ *  the thread that reads the counters should reset the stats.
+ *************************************************************************/
+
+void getLS7336RStats (LS7336R_STATS *Stats)
+	{
+	*Stats = stats;
+	}
+
+void resetLS7336RStats (void)
+	{
+	memset(&stats, 0, sizeof(stats));
+	}
@@ -26,6 +26,8 @@
 #define CLEAR_STATUS	0x30		// 00 (WR) 110 (STR)
 #define READ_COUNTER	0x60
 #define READ_STATUS		0x70
+#define READ_OTR		0x68		// 01 (RD) 101 (OTR)
+#define LOAD_OTR		0xE8		// 11 (LOAD) 101 (OTR), copies CNTR to OTR
 #define WRITE_MODE0		0x88
 #define WRITE_MODE1		0x90
 #define READ_MODE0		0x48
@@ -39,12 +41,76 @@
 #define TWOBYTE_COUNTER		0x02
 #define ONEBYTE_COUNTER		0x03
 
+/*  Status register (STR) flags  */
+#define STATUS_CY		0x80		// carry, counter overflowed upward
+#define STATUS_BW		0x40		// borrow, counter overflowed downward
+#define STATUS_CMP		0x20		// counter matched DTR
+#define STATUS_IDX		0x10		// index input
+#define STATUS_CEN		0x08		// counting enabled
+#define STATUS_PLS		0x04		// power loss since last clear
+#define STATUS_UD		0x02		// counting up
+#define STATUS_S		0x01		// count is negative
+
+/*  SPI backend  */
+// LS7366R_SPIDEV 1 talks to the chips through the hardware SPI
+// controller (/dev/spidev0.0 for CE0, /dev/spidev0.1 for CE1),
+// 0 uses pigpio bit-banged SPI on the same pins
+#ifndef LS7366R_SPIDEV
+#define LS7366R_SPIDEV		1
+#endif
+
+#if LS7366R_SPIDEV
+#define LS7366R_SPI_SPEED	1000000		// default SPI clock (Hz)
+#else
+#define LS7366R_SPI_SPEED	100000
+#endif
+
+/*  Consecutive reads which may be late or fail before a narrow counter
+ *  can no longer be unwrapped, see chooseLS7336RCounterBytes  */
+#define LS7366R_MISSED_READS	16
+
+/*  One counter latched by readLS7336RCountersLatched  */
+typedef struct {
+    long long count;        // unwrapped count copied into OTR
+    unsigned char status;   // STR flags, cleared after each read
+} LS7336R_READING;
+
+/*  Read timing, collected by readLS7336RCounter  */
+typedef struct {
+    unsigned reads;
+    unsigned errors;
+    unsigned ambiguous;     // good reads too long after the last to unwrap for certain
+    unsigned widened;       // counters switched to 4 bytes after a late read
+    unsigned long long last_ns;
+    unsigned long long max_ns;
+    unsigned long long total_ns;
+} LS7336R_STATS;
+
 
 int readLS7336RCounter (int ChipEnable);
 
+long long readLS7336RCounter64 (int ChipEnable);
+
+int setLS7336RCounterBytes (int ChipEnable, int Bytes);
+
+int setLS7336RCounterRate (int ChipEnable, double SampleHz, double MaxRevsPerSec);
+
+int readLS7336RCountersLatched (const int *ChipEnables, int Num, LS7336R_READING *Readings,
+                                unsigned long long *StampNs, unsigned long long *SkewNs);
+
+int chooseLS7336RCounterBytes (double SampleHz, double MaxRevsPerSec);
+
+long long unwrapLS7336RCount (long long Previous, unsigned Raw, int Bytes);
+
 int clearLS7336RCounter (int ChipEnable);
 
 
 int initLS7336RChip (int ChipEnable);
 
+int initLS7336RChipSpeed (int ChipEnable, unsigned Speed);
+
+void getLS7336RStats (LS7336R_STATS *Stats);
+
+void resetLS7336RStats (void);
+
 #endif //SENSOR7366R__H__
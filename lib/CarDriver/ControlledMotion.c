@@ -1,24 +1,55 @@
-#include "CarDriver.h"
+#include <math.h>
+#include "ControlledMotion.h"
+#include "Timing.h"
 
 
 //if MOTORA then use SPI0_CE0 otherwise SPI_CE1 to check count
+//speed comes from the wheel speed service, which must be running
 double revsPerSec(UWORD motor){
 
-	int result;
-	
-	double revsPerSec;
-	double speed;
-	
-	
-	
-
-
-
+	int wheel = (motor == MOTORA) ? WHEEL_LEFT : WHEEL_RIGHT;
 
+	return WheelSpeed_RevPerSec(wheel);
 }
 
 
 //checks if both motors are producing equal rpms, if not loop until equal, loop has internal 3 scond>
 // not just momentary
-int syncRPMS(double &powerA, double &powerB);
-
+//powers are duty cycles in percent. both wheels are given the speed of the average power and the
+//speed controller adjusts each motor until the rpms match, the powers it settled on are written back
+//returns 0 on a match, -1 if the speed controller is not running or the rpms never match
+int syncRPMS(double *powerA, double *powerB){
+
+	double speed = SPEED_CONTROL_DUTY_TO_CM_S(MOTOR_DUTY_PERCENT((*powerA + *powerB) / 2.0));
+	double revsA, revsB;
+	int matchedMs = 0;
+	uint64_t deadline;
+	SpeedControlStats stats;
+
+	if (!SpeedControl_Running()) {
+		return -1;
+	}
+	SpeedControl_SetTarget(FORWARD, speed, speed);
+	deadline = Timing_Deadline(SYNC_TIMEOUT_MS * TIMING_NS_PER_MS);
+
+	while (matchedMs < SYNC_HOLD_MS) {
+		if (Timing_Expired(deadline)) {
+			return -1;
+		}
+		usleep(SYNC_POLL_MS * 1000);
+
+		revsA = revsPerSec(MOTORA);
+		revsB = revsPerSec(MOTORB);
+		if (revsA > 0.0 && fabs(revsA - revsB) <= SYNC_TOLERANCE * revsA) {
+			matchedMs += SYNC_POLL_MS;
+		}
+		else {
+			matchedMs = 0;
+		}
+	}
+
+	SpeedControl_GetStats(&stats);
+	*powerA = fabs(stats.output[WHEEL_LEFT]) * 100.0 / MOTOR_DUTY_MAX;
+	*powerB = fabs(stats.output[WHEEL_RIGHT]) * 100.0 / MOTOR_DUTY_MAX;
+	return 0;
+}
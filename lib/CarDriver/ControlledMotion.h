@@ -8,10 +8,10 @@
 #include "DEV_Config.h"
 #include <time.h>
 #include <pigpio.h>
-#include "DEV_Config.h"
 #include "MotorDriver.h"
 #include "7366rDriver.h"
-#include"../definitons.h"
+#include "WheelSpeed.h"
+#include "SpeedController.h"
 #include <unistd.h>
 //#define SPI0_CE0        GPIO08          //Physical Pin 24
 //#define SPI0_CE1        GPIO07   
@@ -19,12 +19,17 @@
 
 //TODO: CREATE SOME TYPE OF CONTROLBLOCK FOR THE CAR
 
+#define SYNC_TOLERANCE      0.02    //rpms match when within 2% of each other
+#define SYNC_HOLD_MS        3000    //how long a match must last
+#define SYNC_TIMEOUT_MS     10000
+#define SYNC_POLL_MS        20
+
 //if MOTORA then use SPI0_CE0 otherwise SPI_CE1 to check count
 double revsPerSec(UWORD motor);
 
 
 //checks if both motors are producing equal rpms, if not loop until equal, loop has internal 3 scond delay to confirm rpm match is
 // not just momentary
-int syncRPMS(double &powerA, double &powerB);
+int syncRPMS(double *powerA, double *powerB);
 
 #endif
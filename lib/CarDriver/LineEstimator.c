@@ -0,0 +1,194 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         LineEstimator.c
+*
+* Description:
+*   Line position estimator. The front three sensors give a weighted
+*   centroid of the line. Each pattern change pins the line to the edge
+*   of a sensor's reach, and between changes the offset is interpolated
+*   at the speed the line last crossed the sensors, kept within the 
+*   range the current pattern allows. The rear pair gives a second 
+*   offset further back, and the two together give the heading of the
+*   line. When the line is lost the estimate is held on the side it 
+*   was last seen.
+******************************************************************************/
+
+
+#include <math.h>
+#include <string.h>
+
+#include "LineEstimator.h"
+
+
+#define FRONT_MASK  ((1u << LINE_FRONT_LEFT) | (1u << LINE_FRONT_CENTER) | (1u << LINE_FRONT_RIGHT))
+#define HALF_DETECT_CM  (LINE_DETECT_WIDTH_CM / 2.0f)
+
+/* Offsets of the front sensors, left to right */
+static const float front_position[3] = { -LINE_FRONT_SPACING_CM, 0.0f, LINE_FRONT_SPACING_CM };
+
+
+/**
+ * Weighted centroid of the front sensors which see the line. Returns
+ * false if it cannot be told where the line is: nothing is seen, or the 
+ * two outer sensors are on without the center one (a crossing line).
+ */
+static bool front_centroid(uint32_t mask, float* offset_cm)
+{
+    float sum = 0.0f;
+    int count = 0;
+
+    if ((mask & FRONT_MASK) == ((1u << LINE_FRONT_LEFT) | (1u << LINE_FRONT_RIGHT))) {
+        return false;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (mask & (1u << (LINE_FRONT_LEFT + i))) {
+            sum += front_position[i];
+            count++;
+        }
+    }
+    if (count == 0) {
+        return false;
+    }
+    *offset_cm = sum / count;
+    return true;
+}
+
+/**
+ * Range of offsets for which the front sensors would give this pattern.
+ * The line must be within reach of every sensor which sees it, and out
+ * of reach of the sensors either side which do not.
+ */
+static void pattern_range(uint32_t mask, float level, float* lo, float* hi)
+{
+    *lo = -INFINITY;
+    *hi = INFINITY;
+    for (int i = 0; i < 3; i++) {
+        float p = front_position[i];
+
+        if (mask & (1u << (LINE_FRONT_LEFT + i))) {
+            *lo = fmaxf(*lo, p - HALF_DETECT_CM);
+            *hi = fminf(*hi, p + HALF_DETECT_CM);
+        }
+        else if (p < level) {
+            *lo = fmaxf(*lo, p + HALF_DETECT_CM);
+        }
+        else {
+            *hi = fminf(*hi, p - HALF_DETECT_CM);
+        }
+    }
+}
+
+/**
+ * Where the line was when the front pattern changed. If one sensor
+ * changed, the line was at the edge of that sensor's reach on the side
+ * it was moving toward or away from. Otherwise take the midpoint of
+ * the two centroids.
+ */
+static float crossing_offset(uint32_t old_mask, float old_level, uint32_t new_mask, float new_level)
+{
+    uint32_t changed = (old_mask ^ new_mask) & FRONT_MASK;
+    bool rightward = new_level > old_level;
+    float p;
+
+    for (int i = 0; i < 3; i++) {
+        if (changed == (1u << (LINE_FRONT_LEFT + i))) {
+            p = front_position[i];
+            /* Moving right, a sensor turns on at its left edge and 
+             * off at its right edge */
+            if ((new_mask & changed) != 0) {
+                return rightward ? p - HALF_DETECT_CM : p + HALF_DETECT_CM;
+            }
+            return rightward ? p + HALF_DETECT_CM : p - HALF_DETECT_CM;
+        }
+    }
+    return (old_level + new_level) / 2.0f;
+}
+
+/**
+ * Offset of the line at the rear pair. The rear sensors sit either 
+ * side of the line, so neither seeing it means it is centered.
+ */
+static float rear_offset(uint32_t mask)
+{
+    bool left = mask & (1u << LINE_REAR_LEFT);
+    bool right = mask & (1u << LINE_REAR_RIGHT);
+
+    if (left && !right) {
+        return -LINE_REAR_OFFSET_CM;
+    }
+    if (right && !left) {
+        return LINE_REAR_OFFSET_CM;
+    }
+    return 0.0f;
+}
+
+void LineEstimator_Init(LineEstimate* est)
+{
+    memset(est, 0, sizeof(*est));
+    est->last_side = 1.0f;
+}
+
+/**
+ * Update the estimate with a line sensor reading taken at stamp_ns,
+ * where bit i of the mask is set when sensor i sees the line. Can be
+ * called with the same reading repeatedly to advance the interpolation.
+ */
+void LineEstimator_Update(LineEstimate* est, uint32_t mask, uint64_t stamp_ns)
+{
+    float level, offset, dt_s, lo, hi;
+    bool known = front_centroid(mask, &level);
+
+    if ((mask & FRONT_MASK) != (est->mask & FRONT_MASK) && known) {
+        if (est->have_level && (est->mask & FRONT_MASK) != 0) {
+            /* The line has just crossed the edge of a sensor */
+            offset = crossing_offset(est->mask, est->level_cm, mask, level);
+            dt_s = (stamp_ns - est->crossing_ns) / 1e9f;
+            if (est->crossing_ns != 0 && dt_s > 0.0f && dt_s < LINE_CROSSING_MAX_MS / 1e3f) {
+                est->rate_cm_s = (offset - est->crossing_cm) / dt_s;
+            }
+            else {
+                est->rate_cm_s = 0.0f;
+            }
+            est->crossing_cm = offset;
+        }
+        else {
+            /* First sighting, or the line has been found again */
+            est->crossing_cm = level;
+            est->rate_cm_s = 0.0f;
+        }
+        est->crossing_ns = stamp_ns;
+        est->level_cm = level;
+        est->have_level = true;
+    }
+    est->mask = mask;
+    est->stamp_ns = stamp_ns;
+
+    est->lost = (mask & FRONT_MASK) == 0;
+    if (est->lost) {
+        est->offset_cm = est->last_side * LINE_LOST_OFFSET_CM;
+        est->rate_cm_s = 0.0f;
+    }
+    else if (known && est->have_level) {
+        /* Carry on at the last crossing speed, but stay within the
+         * offsets the current pattern can stand for */
+        offset = est->crossing_cm + est->rate_cm_s * ((stamp_ns - est->crossing_ns) / 1e9f);
+        pattern_range(mask, est->level_cm, &lo, &hi);
+        est->offset_cm = fminf(hi, fmaxf(lo, offset));
+    }
+    /* Otherwise the pattern is ambiguous, so hold the last offset */
+
+    if (!est->lost && est->offset_cm != 0.0f) {
+        est->last_side = est->offset_cm > 0.0f ? 1.0f : -1.0f;
+    }
+    est->heading_rad = atan2f(est->offset_cm - rear_offset(mask), LINE_SENSOR_BASE_CM);
+    est->error = est->offset_cm + LINE_HEADING_GAIN_CM * est->heading_rad;
+}
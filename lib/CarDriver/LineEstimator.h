@@ -0,0 +1,70 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         LineEstimator.h
+*
+* Description:
+*   Declarations for the line position estimator, which turns the line
+*   sensor readings into a continuous lateral offset and heading error.
+******************************************************************************/
+
+#ifndef _LINE_ESTIMATOR_H
+#define _LINE_ESTIMATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Sensor bits in a line sensor mask */
+#define LINE_FRONT_LEFT     0
+#define LINE_FRONT_CENTER   1
+#define LINE_FRONT_RIGHT    2
+#define LINE_REAR_LEFT      3
+#define LINE_REAR_RIGHT     4
+
+/* Sensor geometry */
+#define LINE_FRONT_SPACING_CM   1.5f    /* Between neighbouring front sensors */
+#define LINE_DETECT_WIDTH_CM    2.0f    /* Span of offsets over which one sensor sees the line */
+#define LINE_REAR_OFFSET_CM     3.0f    /* From the center line to each rear sensor */
+#define LINE_SENSOR_BASE_CM     12.0f   /* From the rear pair to the front row */
+
+/* Offset reported while the line is lost, just beyond the outer sensor */
+#define LINE_LOST_OFFSET_CM     (1.5f * LINE_FRONT_SPACING_CM)
+
+/* Crossings further apart than this are not used to estimate how fast
+ * the line is moving across the sensors */
+#define LINE_CROSSING_MAX_MS    500
+
+/* Weight of the heading error in the steering error, in cm per radian */
+#define LINE_HEADING_GAIN_CM    5.0f
+
+typedef struct {
+    /* Estimate, positive when the line is to the right of the car */
+    float offset_cm;            /* Lateral offset of the line at the front sensors */
+    float heading_rad;          /* Angle of the line relative to the car */
+    float rate_cm_s;            /* Speed the line is moving across the front sensors */
+    float error;                /* Combined steering error, in cm */
+    bool lost;                  /* No front sensor sees the line */
+    uint64_t stamp_ns;          /* Time of the reading */
+
+    /* Tracking state */
+    uint32_t mask;
+    bool have_level;
+    float level_cm;             /* Centroid of the current front pattern */
+    float crossing_cm;          /* Offset when the front pattern last changed */
+    uint64_t crossing_ns;
+    float last_side;            /* -1 or 1, side the line was last seen on */
+} LineEstimate;
+
+void LineEstimator_Init(LineEstimate* est);
+void LineEstimator_Update(LineEstimate* est, uint32_t mask, uint64_t stamp_ns);
+
+
+#endif  /* _LINE_ESTIMATOR_H */
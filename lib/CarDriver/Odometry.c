@@ -0,0 +1,200 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         Odometry.c
+*
+* Description:
+*   Dead-reckoning pose estimator. Each encoder sample from the wheel
+*   speed service is integrated with differential-drive kinematics, and
+*   the pose covariance is grown with a wheel slip model so callers can
+*   tell how far the estimate can be trusted. The pose is published
+*   behind a sequence lock, so readers never block the sampling thread.
+******************************************************************************/
+
+
+#include <math.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "7366rDriver.h"
+#include "Odometry.h"
+#include "Timing.h"
+
+
+#define CM_PER_COUNT    ((float)(2.0 * PI * WHEEL_RADIUS / PULSES_PER_REV))
+
+static float track_width_cm = ODOMETRY_TRACK_WIDTH_CM;
+
+/* Writer state, only touched by the sampling thread */
+static OdometryPose current;
+static int64_t prev_count[NUM_WHEELS];
+static bool have_prev;
+
+static atomic_bool reset_requested;
+
+/* Published copy */
+static atomic_uint pose_lock;       /* Odd while the pose is being written */
+static OdometryPose published;
+
+
+static void publish(const OdometryPose* pose)
+{
+    unsigned lock = atomic_load_explicit(&pose_lock, memory_order_relaxed);
+
+    atomic_store_explicit(&pose_lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    published = *pose;
+    atomic_store_explicit(&pose_lock, lock + 2, memory_order_release);
+}
+
+/**
+ * Grow the covariance for a step of the left and right wheels.
+ *
+ * P = F P F' + G Q G', where F is the Jacobian of the motion with
+ * respect to the pose, G is the Jacobian with respect to the wheel
+ * travel, and Q is the wheel slip variance, proportional to the
+ * distance each wheel travelled.
+ */
+static void grow_covariance(float cov[3][3], float heading, float d, float dl, float dr)
+{
+    const float b = track_width_cm;
+    float c = cosf(heading);
+    float s = sinf(heading);
+    float F[3][3] = {
+        { 1.0f, 0.0f, -d * s },
+        { 0.0f, 1.0f,  d * c },
+        { 0.0f, 0.0f,  1.0f  }
+    };
+    float G[3][2] = {
+        { 0.5f * c + d * s / (2.0f * b), 0.5f * c - d * s / (2.0f * b) },
+        { 0.5f * s - d * c / (2.0f * b), 0.5f * s + d * c / (2.0f * b) },
+        { -1.0f / b,                      1.0f / b                      }
+    };
+    float q[2] = { ODOMETRY_SLIP_VARIANCE * fabsf(dl), ODOMETRY_SLIP_VARIANCE * fabsf(dr) };
+    float FP[3][3];
+    float next[3][3];
+
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            FP[i][j] = 0.0f;
+            for (int k = 0; k < 3; k++) {
+                FP[i][j] += F[i][k] * cov[k][j];
+            }
+        }
+    }
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            next[i][j] = 0.0f;
+            for (int k = 0; k < 3; k++) {
+                next[i][j] += FP[i][k] * F[j][k];
+            }
+            next[i][j] += G[i][0] * q[0] * G[j][0] + G[i][1] * q[1] * G[j][1];
+        }
+    }
+    memcpy(cov, next, sizeof(next));
+}
+
+/**
+ * Set the track width and clear the pose. Must be called before
+ * the wheel speed service starts.
+ */
+void Odometry_Init(float track_width)
+{
+    track_width_cm = track_width;
+    memset(&current, 0, sizeof(current));
+    have_prev = false;
+    atomic_store(&reset_requested, false);
+}
+
+/**
+ * Move the origin to the current position and heading of the car.
+ * Takes effect at the next encoder sample.
+ */
+void Odometry_Reset(void)
+{
+    atomic_store(&reset_requested, true);
+}
+
+/**
+ * Wheel speed listener which integrates one encoder sample.
+ * The wheel speed service calls this from its sampling thread.
+ */
+void Odometry_OnSample(const WheelSample* sample, void* arg)
+{
+    float dl, dr, d, dtheta, mid, dt_s;
+
+    if (atomic_exchange(&reset_requested, false)) {
+        memset(&current, 0, sizeof(current));
+    }
+    if (!have_prev) {
+        memcpy(prev_count, sample->count, sizeof(prev_count));
+        have_prev = true;
+    }
+
+    dl = (sample->count[WHEEL_LEFT] - prev_count[WHEEL_LEFT]) * CM_PER_COUNT;
+    dr = (sample->count[WHEEL_RIGHT] - prev_count[WHEEL_RIGHT]) * CM_PER_COUNT;
+    memcpy(prev_count, sample->count, sizeof(prev_count));
+
+    d = (dl + dr) / 2.0f;
+    dtheta = (dr - dl) / track_width_cm;
+    /* Heading at the middle of the step */
+    mid = current.heading_rad + dtheta / 2.0f;
+
+    grow_covariance(current.cov, mid, d, dl, dr);
+    current.x_cm += d * cosf(mid);
+    current.y_cm += d * sinf(mid);
+    current.heading_rad = remainderf(current.heading_rad + dtheta, 2.0f * (float)PI);
+    current.turned_rad += dtheta;
+    current.distance_cm += fabsf(d);
+
+    dt_s = (sample->stamp_ns - current.stamp_ns) / 1e9f;
+    if (current.stamp_ns != 0 && dt_s > 0.0f) {
+        current.v_cm_s = d / dt_s;
+        current.omega_rad_s = dtheta / dt_s;
+    }
+    current.stamp_ns = sample->stamp_ns;
+    current.seq++;
+    publish(&current);
+}
+
+/**
+ * Get a consistent copy of the latest pose. Returns false if no
+ * encoder sample has been integrated yet.
+ */
+bool Odometry_GetPose(OdometryPose* pose)
+{
+    unsigned before, after;
+
+    do {
+        before = atomic_load_explicit(&pose_lock, memory_order_acquire);
+        if (before & 1) {
+            continue;
+        }
+        *pose = published;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&pose_lock, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    return pose->seq != 0;
+}
+
+/**
+ * Whether the pose is being kept up to date by the encoders.
+ */
+bool Odometry_Valid(void)
+{
+    OdometryPose pose;
+
+    if (!Odometry_GetPose(&pose)) {
+        return false;
+    }
+    return Timing_NowNs() - pose.stamp_ns < ODOMETRY_STALE_MS * TIMING_NS_PER_MS;
+}
@@ -0,0 +1,61 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         Odometry.h
+*
+* Description:
+*   Declarations for the dead-reckoning pose estimator, which tracks the
+*   position and heading of the car from the wheel encoder counts.
+******************************************************************************/
+
+#ifndef _ODOMETRY_H
+#define _ODOMETRY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "WheelSpeed.h"
+
+#define ODOMETRY_TRACK_WIDTH_CM 15.0f   /* Distance between the wheel contact points */
+
+/* Wheel slip model: the variance of each wheel's travel grows by
+ * this much per cm travelled (cm^2 / cm) */
+#define ODOMETRY_SLIP_VARIANCE  0.05f
+
+/* A pose older than this is treated as unavailable */
+#define ODOMETRY_STALE_MS       50
+
+/* Pose of the car relative to where odometry was last reset.
+ * x is forward along the starting heading, y is to the left, and
+ * heading is counter-clockwise in radians within [-pi, pi], either
+ * end being possible where remainderf() rounds a half turn. */
+typedef struct {
+    uint32_t seq;               /* Update number */
+    uint64_t stamp_ns;          /* Monotonic time of the encoder sample */
+    float x_cm;
+    float y_cm;
+    float heading_rad;
+    float turned_rad;           /* Total heading change, not wrapped */
+    float distance_cm;          /* Total path length travelled */
+    float v_cm_s;               /* Forward speed */
+    float omega_rad_s;          /* Turn rate, counter-clockwise */
+    float cov[3][3];            /* Covariance of (x, y, heading) */
+} OdometryPose;
+
+void Odometry_Init(float track_width_cm);
+void Odometry_Reset(void);
+void Odometry_OnSample(const WheelSample* sample, void* arg);
+
+bool Odometry_GetPose(OdometryPose* pose);
+bool Odometry_Valid(void);
+
+
+#endif  /* _ODOMETRY_H */
@@ -0,0 +1,314 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         SpeedController.c
+*
+* Description:
+*   Closed-loop wheel speed controller. A fixed-rate thread runs a PI
+*   controller with feedforward for each wheel, using the filtered
+*   speeds from the wheel speed service, and sends the resulting duty
+*   cycles to the motor actuator. While it is running the controller is
+*   the only thread which publishes motor commands.
+******************************************************************************/
+
+
+#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "SpeedController.h"
+#include "Timing.h"
+
+
+static pthread_t control_thread;
+static atomic_bool running;
+static _Atomic float target[NUM_WHEELS];    /* Signed, positive is forward */
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static SpeedControlStats stats;
+static double period_total_us;
+static double error_sq_total[NUM_WHEELS];
+static uint32_t error_count[NUM_WHEELS];
+
+
+/**
+ * Initialize a wheel controller. The output is a signed duty cycle
+ * limited to +/- out_max.
+ */
+void WheelPid_Init(WheelPid* pid, float kp, float ki, float kd, float kff, float out_max)
+{
+    pid->kp = kp;
+    pid->ki = ki;
+    pid->kd = kd;
+    pid->kff = kff;
+    pid->out_max = out_max;
+    WheelPid_Reset(pid);
+}
+
+void WheelPid_Reset(WheelPid* pid)
+{
+    pid->integral = 0.0f;
+    pid->prev_measured = 0.0f;
+    pid->saturated = false;
+}
+
+/**
+ * Compute the next output of a wheel controller.
+ *
+ * The feedforward term supplies most of the output, so the integral
+ * only has to correct for load and motor differences. The derivative
+ * acts on the measurement rather than the error, so a step in the
+ * target does not kick the output.
+ *
+ * When the output saturates, the integral is not allowed to grow any
+ * further in the direction of the saturation (conditional integration),
+ * so it does not wind up while the motor is at full duty.
+ */
+float WheelPid_Update(WheelPid* pid, float target, float measured, float dt_s)
+{
+    float error = target - measured;
+    float derivative = 0.0f;
+    float integral = pid->integral;
+    float output;
+
+    if (dt_s > 0.0f) {
+        derivative = -(measured - pid->prev_measured) / dt_s;
+        integral += pid->ki * error * dt_s;
+    }
+    pid->prev_measured = measured;
+
+    output = pid->kff * target + pid->kp * error + pid->kd * derivative + integral;
+    pid->saturated = true;
+    if (output > pid->out_max) {
+        if (error > 0.0f) {
+            integral = pid->integral;
+        }
+        output = pid->out_max;
+    }
+    else if (output < -pid->out_max) {
+        if (error < 0.0f) {
+            integral = pid->integral;
+        }
+        output = -pid->out_max;
+    }
+    else {
+        pid->saturated = false;
+    }
+    pid->integral = fmaxf(-pid->out_max, fminf(integral, pid->out_max));
+    return output;
+}
+
+/**
+ * Send signed wheel outputs to the actuator. The four combinations
+ * of wheel directions map onto the four driving directions.
+ */
+static void publish_output(const float output[NUM_WHEELS])
+{
+    bool left_fwd = output[WHEEL_LEFT] >= 0.0f;
+    bool right_fwd = output[WHEEL_RIGHT] >= 0.0f;
+    DIR dir;
+
+    if (left_fwd && right_fwd) {
+        dir = FORWARD;
+    } else if (right_fwd) {
+        dir = LEFT;
+    } else if (left_fwd) {
+        dir = RIGHT;
+    } else {
+        dir = BACKWARD;
+    }
+    Actuator_Publish(dir,
+        (UWORD)(fabsf(output[WHEEL_LEFT]) + 0.5f),
+        (UWORD)(fabsf(output[WHEEL_RIGHT]) + 0.5f));
+}
+
+static void record_stats(const WheelPid pid[NUM_WHEELS], const float goal[NUM_WHEELS],
+    const WheelSample* sample, const float output[NUM_WHEELS], float period_us, float loop_us)
+{
+    const float nominal_us = 1e6f / SPEED_CONTROL_HZ;
+    float error;
+
+    pthread_mutex_lock(&stats_lock);
+    stats.loops++;
+    period_total_us += period_us;
+    stats.period_mean_us = period_total_us / stats.loops;
+    stats.period_jitter_us = fmaxf(stats.period_jitter_us, fabsf(period_us - nominal_us));
+    stats.loop_max_us = fmaxf(stats.loop_max_us, loop_us);
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        stats.target_cm_s[i] = goal[i];
+        stats.measured_cm_s[i] = sample->cm_s[i];
+        stats.output[i] = output[i];
+        if (pid[i].saturated) {
+            stats.saturated[i]++;
+        }
+        /* Only count tracking error while the wheel is meant to move */
+        if (goal[i] != 0.0f) {
+            error = goal[i] - sample->cm_s[i];
+            error_sq_total[i] += error * error;
+            error_count[i]++;
+            stats.error_rms_cm_s[i] = sqrt(error_sq_total[i] / error_count[i]);
+            stats.error_max_cm_s[i] = fmaxf(stats.error_max_cm_s[i], fabsf(error));
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+/**
+ * Thread routine which runs both wheel controllers at SPEED_CONTROL_HZ.
+ * A wheel with a target of zero is stopped outright and its controller
+ * reset, rather than being held at zero speed by the controller.
+ */
+static void* control_routine(void* arg)
+{
+    const uint64_t period_ns = TIMING_NS_PER_S / SPEED_CONTROL_HZ;
+    WheelPid pid[NUM_WHEELS];
+    WheelSample sample;
+    float goal[NUM_WHEELS];
+    float output[NUM_WHEELS] = { 0.0f, 0.0f };
+    float sent[NUM_WHEELS] = { -1.0f, -1.0f };
+    uint64_t next_ns = Timing_NowNs();
+    uint64_t last_ns = next_ns;
+    uint64_t start;
+    uint32_t missed;
+    float dt_s;
+
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        WheelPid_Init(&pid[i], SPEED_CONTROL_KP, SPEED_CONTROL_KI, SPEED_CONTROL_KD,
+            SPEED_CONTROL_KFF, MOTOR_DUTY_MAX);
+    }
+
+    while (atomic_load(&running))
+    {
+        missed = Timing_NextPeriod(&next_ns, period_ns);
+        if (missed != 0) {
+            pthread_mutex_lock(&stats_lock);
+            stats.overruns += missed;
+            pthread_mutex_unlock(&stats_lock);
+        }
+        Timing_SleepUntil(next_ns);
+
+        start = Timing_NowNs();
+        dt_s = (start - last_ns) / 1e9f;
+        last_ns = start;
+        if (!WheelSpeed_Latest(&sample)) {
+            continue;
+        }
+
+        for (int i = 0; i < NUM_WHEELS; i++) {
+            goal[i] = atomic_load_explicit(&target[i], memory_order_relaxed);
+            if (goal[i] == 0.0f) {
+                WheelPid_Reset(&pid[i]);
+                pid[i].prev_measured = sample.cm_s[i];
+                output[i] = 0.0f;
+            } else {
+                output[i] = WheelPid_Update(&pid[i], goal[i], sample.cm_s[i], dt_s);
+            }
+        }
+        if (roundf(output[WHEEL_LEFT]) != sent[WHEEL_LEFT]
+            || roundf(output[WHEEL_RIGHT]) != sent[WHEEL_RIGHT]) {
+            publish_output(output);
+            sent[WHEEL_LEFT] = roundf(output[WHEEL_LEFT]);
+            sent[WHEEL_RIGHT] = roundf(output[WHEEL_RIGHT]);
+        }
+        record_stats(pid, goal, &sample, output, dt_s * 1e6f, (Timing_NowNs() - start) / 1e3f);
+    }
+    return NULL;
+}
+
+/**
+ * Start the speed controller. The actuator and wheel speed service
+ * must already be running. Both wheels start with a target of zero.
+ * Returns 0 on success.
+ */
+int SpeedControl_Start(void)
+{
+    atomic_store(&target[WHEEL_LEFT], 0.0f);
+    atomic_store(&target[WHEEL_RIGHT], 0.0f);
+    SpeedControl_ResetStats();
+    atomic_store(&running, true);
+    if (pthread_create(&control_thread, NULL, control_routine, NULL) != 0) {
+        atomic_store(&running, false);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop the speed controller. The motors are left at the last
+ * output, so the caller should stop them.
+ */
+void SpeedControl_Stop(void)
+{
+    if (!atomic_exchange(&running, false)) {
+        return;
+    }
+    pthread_join(control_thread, NULL);
+}
+
+bool SpeedControl_Running(void)
+{
+    return atomic_load(&running);
+}
+
+/**
+ * Set the target ground speed of each wheel in cm/s. Speeds are
+ * magnitudes; the direction applies them to each wheel the same way
+ * as a motor command (e.g. LEFT drives the left wheel backward).
+ */
+void SpeedControl_SetTarget(DIR dir, float left_cm_s, float right_cm_s)
+{
+    float left = fabsf(left_cm_s);
+    float right = fabsf(right_cm_s);
+
+    if (dir == BACKWARD || dir == LEFT) {
+        left = -left;
+    }
+    if (dir == BACKWARD || dir == RIGHT) {
+        right = -right;
+    }
+    atomic_store_explicit(&target[WHEEL_LEFT], left, memory_order_relaxed);
+    atomic_store_explicit(&target[WHEEL_RIGHT], right, memory_order_relaxed);
+}
+
+void SpeedControl_GetStats(SpeedControlStats* out)
+{
+    pthread_mutex_lock(&stats_lock);
+    *out = stats;
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void SpeedControl_ResetStats(void)
+{
+    pthread_mutex_lock(&stats_lock);
+    memset(&stats, 0, sizeof(stats));
+    period_total_us = 0.0;
+    memset(error_sq_total, 0, sizeof(error_sq_total));
+    memset(error_count, 0, sizeof(error_count));
+    pthread_mutex_unlock(&stats_lock);
+}
+
+void SpeedControl_PrintStats(void)
+{
+    SpeedControlStats s;
+    SpeedControl_GetStats(&s);
+
+    if (s.loops == 0) {
+        return;
+    }
+    printf("SpeedControl: %u loops, %u overruns, period mean %.1f us, jitter %.1f us, compute max %.1f us\n",
+        s.loops, s.overruns, s.period_mean_us, s.period_jitter_us, s.loop_max_us);
+    printf("SpeedControl: left error rms %.2f cm/s, max %.2f cm/s, saturated %u\n",
+        s.error_rms_cm_s[WHEEL_LEFT], s.error_max_cm_s[WHEEL_LEFT], s.saturated[WHEEL_LEFT]);
+    printf("SpeedControl: right error rms %.2f cm/s, max %.2f cm/s, saturated %u\n",
+        s.error_rms_cm_s[WHEEL_RIGHT], s.error_max_cm_s[WHEEL_RIGHT], s.saturated[WHEEL_RIGHT]);
+}
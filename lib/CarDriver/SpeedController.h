@@ -0,0 +1,83 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         SpeedController.h
+*
+* Description:
+*   Declarations for the closed-loop wheel speed controller, which holds
+*   each wheel at a target speed using feedback from the wheel speed
+*   service.
+******************************************************************************/
+
+#ifndef _SPEED_CONTROLLER_H
+#define _SPEED_CONTROLLER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "MotorActuator.h"
+#include "WheelSpeed.h"
+
+#define SPEED_CONTROL_HZ        50      /* Control loop rate */
+
+/* Wheel speed at full duty with the car on the ground. Used for the
+ * feedforward term and to map duty cycle requests to speeds. */
+#define SPEED_CONTROL_MAX_CM_S  100.0f
+
+/* Gains, in duty counts per cm/s of error (and per cm of integrated error) */
+#define SPEED_CONTROL_KP        20.0f
+#define SPEED_CONTROL_KI        80.0f
+#define SPEED_CONTROL_KD        0.0f
+#define SPEED_CONTROL_KFF       (MOTOR_DUTY_MAX / SPEED_CONTROL_MAX_CM_S)
+
+/* Convert a duty cycle request (0 ~ MOTOR_DUTY_MAX) to a target speed */
+#define SPEED_CONTROL_DUTY_TO_CM_S(duty) ((duty) * SPEED_CONTROL_MAX_CM_S / MOTOR_DUTY_MAX)
+
+typedef struct {
+    float kp;
+    float ki;
+    float kd;
+    float kff;
+    float out_max;          /* Output is limited to +/- out_max */
+    float integral;         /* Integral term, already scaled by ki */
+    float prev_measured;
+    bool saturated;         /* The last output was clipped */
+} WheelPid;
+
+typedef struct {
+    uint32_t loops;
+    uint32_t overruns;          /* Periods missed entirely */
+    float period_mean_us;
+    float period_jitter_us;     /* Largest deviation from the nominal period */
+    float loop_max_us;          /* Longest time spent computing one update */
+    uint32_t saturated[NUM_WHEELS];         /* Updates with the output clipped */
+    float target_cm_s[NUM_WHEELS];
+    float measured_cm_s[NUM_WHEELS];
+    float output[NUM_WHEELS];               /* Signed duty counts */
+    float error_rms_cm_s[NUM_WHEELS];
+    float error_max_cm_s[NUM_WHEELS];
+} SpeedControlStats;
+
+void WheelPid_Init(WheelPid* pid, float kp, float ki, float kd, float kff, float out_max);
+void WheelPid_Reset(WheelPid* pid);
+float WheelPid_Update(WheelPid* pid, float target, float measured, float dt_s);
+
+int SpeedControl_Start(void);
+void SpeedControl_Stop(void);
+bool SpeedControl_Running(void);
+void SpeedControl_SetTarget(DIR dir, float left_cm_s, float right_cm_s);
+
+void SpeedControl_GetStats(SpeedControlStats* stats);
+void SpeedControl_ResetStats(void);
+void SpeedControl_PrintStats(void);
+
+
+#endif  /* _SPEED_CONTROLLER_H */
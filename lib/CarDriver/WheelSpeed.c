@@ -0,0 +1,340 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         WheelSpeed.c
+*
+* Description:
+*   Wheel velocity service. A sampling thread reads both LS7366R counters
+*   at a fixed rate and stores each pair of counts with a monotonic
+*   timestamp in a ring buffer. Speeds are estimated from the change in
+*   count across several samples and then low-pass filtered, so a single
+*   late sample does not show up as a speed spike. Readers never block
+*   the sampling thread.
+******************************************************************************/
+
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "7366rDriver.h"
+#include "Timing.h"
+#include "WheelSpeed.h"
+
+
+#define WHEEL_CIRCUMFERENCE_CM  (2.0 * PI * WHEEL_RADIUS)
+
+typedef struct {
+    atomic_uint lock;       /* Odd while the slot is being written */
+    WheelSample sample;
+} WheelSlot;
+
+static WheelSlot ring[WHEEL_SPEED_RING_LEN];
+static atomic_uint ring_head;       /* Number of samples published */
+
+static WheelSpeedConfig config;
+static pthread_t sample_thread;
+static atomic_bool running;
+
+static atomic_uint stat_overruns;   /* Sample periods missed entirely */
+static atomic_ullong stat_read_max_ns;
+static atomic_ullong stat_read_total_ns;
+static atomic_ullong stat_skew_max_ns;
+static atomic_ullong stat_skew_total_ns;
+static atomic_uint stat_wraps[NUM_WHEELS];      /* Samples with a carry or borrow */
+
+static const int wheel_sign[NUM_WHEELS] = { WHEEL_SIGN_LEFT, WHEEL_SIGN_RIGHT };
+
+
+
+/**
+ * Copy a sample out of the ring. Returns false if the slot was
+ * overwritten while it was being read.
+ */
+static bool read_slot(unsigned index, WheelSample* sample)
+{
+    WheelSlot* slot = &ring[index & (WHEEL_SPEED_RING_LEN - 1)];
+    unsigned before, after;
+
+    before = atomic_load_explicit(&slot->lock, memory_order_acquire);
+    if (before & 1) {
+        return false;
+    }
+    *sample = slot->sample;
+    atomic_thread_fence(memory_order_acquire);
+    after = atomic_load_explicit(&slot->lock, memory_order_relaxed);
+    return before == after;
+}
+
+/**
+ * Store a sample in the next slot and publish it. Only the sampling
+ * thread writes to the ring.
+ */
+static void publish(const WheelSample* sample)
+{
+    unsigned head = atomic_load_explicit(&ring_head, memory_order_relaxed);
+    WheelSlot* slot = &ring[head & (WHEEL_SPEED_RING_LEN - 1)];
+    unsigned lock = atomic_load_explicit(&slot->lock, memory_order_relaxed);
+
+    atomic_store_explicit(&slot->lock, lock + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    slot->sample = *sample;
+    atomic_store_explicit(&slot->lock, lock + 2, memory_order_release);
+    atomic_store_explicit(&ring_head, head + 1, memory_order_release);
+}
+
+static void update_max(atomic_ullong* max, uint64_t value)
+{
+    if (value > atomic_load_explicit(max, memory_order_relaxed)) {
+        atomic_store_explicit(max, value, memory_order_relaxed);
+    }
+}
+
+/**
+ * Read both counters and fill in the counts and timestamp of a sample.
+ *
+ * In latched mode both counters are copied to their output registers
+ * together and the sample is stamped at the latch. Otherwise the 
+ * counters are read in turn and the sample is stamped between the two
+ * reads, so the skew is a whole read.
+ */
+static void read_counters(WheelSample* sample)
+{
+    uint64_t start = Timing_NowNs();
+    uint64_t elapsed;
+#if WHEEL_SPEED_LATCHED
+    LS7336R_READING reading[NUM_WHEELS];
+    unsigned long long stamp, skew;
+
+    readLS7336RCountersLatched(config.chip_enable, NUM_WHEELS, reading, &stamp, &skew);
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        sample->count[i] = wheel_sign[i] * reading[i].count;
+        sample->status[i] = reading[i].status;
+        if (reading[i].status & (STATUS_CY | STATUS_BW)) {
+            atomic_fetch_add_explicit(&stat_wraps[i], 1, memory_order_relaxed);
+        }
+    }
+    sample->stamp_ns = stamp;
+    sample->skew_ns = skew;
+#else
+    uint64_t read_at[NUM_WHEELS];
+
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        sample->count[i] = wheel_sign[i] * readLS7336RCounter64(config.chip_enable[i]);
+        read_at[i] = Timing_NowNs();
+    }
+    sample->skew_ns = read_at[NUM_WHEELS - 1] - read_at[0];
+    sample->stamp_ns = read_at[0] + sample->skew_ns / 2;
+#endif
+    elapsed = Timing_NowNs() - start;
+
+    atomic_fetch_add_explicit(&stat_read_total_ns, elapsed, memory_order_relaxed);
+    update_max(&stat_read_max_ns, elapsed);
+    atomic_fetch_add_explicit(&stat_skew_total_ns, sample->skew_ns, memory_order_relaxed);
+    update_max(&stat_skew_max_ns, sample->skew_ns);
+}
+
+/**
+ * Estimate the wheel speeds of a new sample from the sample
+ * WHEEL_SPEED_WINDOW periods before it (or the oldest one available),
+ * then blend the estimate into the previous filtered speed.
+ */
+static void estimate_speed(WheelSample* sample, const WheelSample* prev, const WheelSample* base)
+{
+    double dt_s = (sample->stamp_ns - base->stamp_ns) / 1e9;
+    double raw;
+
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        raw = 0.0;
+        if (dt_s > 0.0) {
+            raw = (sample->count[i] - base->count[i]) / PULSES_PER_REV / dt_s;
+        }
+        sample->rev_s[i] = prev->rev_s[i] + WHEEL_SPEED_ALPHA * (raw - prev->rev_s[i]);
+        sample->cm_s[i] = sample->rev_s[i] * WHEEL_CIRCUMFERENCE_CM;
+    }
+}
+
+/**
+ * Thread routine which samples the encoders at WHEEL_SPEED_SAMPLE_HZ.
+ * Periods are counted from a fixed start time so the rate does not
+ * drift; if the thread falls behind, missed periods are skipped
+ * rather than sampled back to back.
+ */
+static void* sample_routine(void* arg)
+{
+    const uint64_t period_ns = TIMING_NS_PER_S / WHEEL_SPEED_SAMPLE_HZ;
+    WheelSample sample = { 0 };
+    WheelSample prev;
+    WheelSample base;
+    uint64_t next_ns = Timing_NowNs();
+    uint32_t seq = 0;
+    uint32_t missed;
+
+    read_counters(&sample);
+    publish(&sample);
+
+    while (atomic_load(&running))
+    {
+        missed = Timing_NextPeriod(&next_ns, period_ns);
+        if (missed != 0) {
+            atomic_fetch_add_explicit(&stat_overruns, missed, memory_order_relaxed);
+        }
+        Timing_SleepUntil(next_ns);
+
+        prev = sample;
+        if (!WheelSpeed_History(WHEEL_SPEED_WINDOW - 1, &base)
+            && !WheelSpeed_History(seq, &base)) {
+            base = prev;
+        }
+        sample.seq = ++seq;
+        read_counters(&sample);
+        estimate_speed(&sample, &prev, &base);
+        publish(&sample);
+
+        if (config.listener) {
+            config.listener(&sample, config.listener_arg);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start sampling the encoders. initLS7336RChip must be called
+ * for both chips first. Returns 0 on success.
+ *
+ * The counters are switched to the narrowest width that can still be
+ * unwrapped at the sample rate with reads missed, which shortens every
+ * read. A counter is widened to 4 bytes if sampling stalls for too long.
+ */
+int WheelSpeed_Start(const WheelSpeedConfig* cfg)
+{
+    config = *cfg;
+    for (int i = 0; i < NUM_WHEELS; i++) {
+        if (setLS7336RCounterRate(config.chip_enable[i], WHEEL_SPEED_SAMPLE_HZ, WHEEL_SPEED_MAX_REV_S) != 0) {
+            return -1;
+        }
+    }
+    atomic_store(&ring_head, 0);
+    atomic_store(&stat_overruns, 0);
+    atomic_store(&stat_read_max_ns, 0);
+    atomic_store(&stat_read_total_ns, 0);
+    atomic_store(&stat_skew_max_ns, 0);
+    atomic_store(&stat_skew_total_ns, 0);
+    atomic_store(&stat_wraps[WHEEL_LEFT], 0);
+    atomic_store(&stat_wraps[WHEEL_RIGHT], 0);
+    atomic_store(&running, true);
+    if (pthread_create(&sample_thread, NULL, sample_routine, NULL) != 0) {
+        atomic_store(&running, false);
+        return -1;
+    }
+    return 0;
+}
+
+void WheelSpeed_Stop(void)
+{
+    atomic_store(&running, false);
+    pthread_join(sample_thread, NULL);
+}
+
+/**
+ * Get the most recent sample. Returns false if no sample
+ * has been taken yet.
+ */
+bool WheelSpeed_Latest(WheelSample* sample)
+{
+    return WheelSpeed_History(0, sample);
+}
+
+/**
+ * Get the sample taken age periods before the most recent one.
+ * Returns false if that sample is not (or no longer) in the ring.
+ */
+bool WheelSpeed_History(uint32_t age, WheelSample* sample)
+{
+    unsigned head;
+
+    /* The slot after the newest one may be in the middle of a write */
+    if (age >= WHEEL_SPEED_RING_LEN - 1) {
+        return false;
+    }
+    for (;;) {
+        head = atomic_load_explicit(&ring_head, memory_order_acquire);
+        if (age >= head) {
+            return false;
+        }
+        if (read_slot(head - 1 - age, sample)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * Filtered speed of a wheel in revolutions per second,
+ * positive when the car is moving forward.
+ */
+float WheelSpeed_RevPerSec(int wheel)
+{
+    WheelSample sample;
+    if (!WheelSpeed_Latest(&sample)) {
+        return 0.0f;
+    }
+    return sample.rev_s[wheel];
+}
+
+/**
+ * Filtered ground speed of a wheel in cm/s.
+ */
+float WheelSpeed_CmPerSec(int wheel)
+{
+    WheelSample sample;
+    if (!WheelSpeed_Latest(&sample)) {
+        return 0.0f;
+    }
+    return sample.cm_s[wheel];
+}
+
+void WheelSpeed_PrintStats(void)
+{
+    WheelSample sample;
+    LS7336R_STATS encoder;
+    unsigned samples = atomic_load(&ring_head);
+
+    if (samples == 0) {
+        return;
+    }
+    printf("WheelSpeed: %u samples, %u overruns, read mean %.1f us, max %.1f us\n",
+        samples, atomic_load(&stat_overruns),
+        atomic_load(&stat_read_total_ns) / 1000.0 / samples,
+        atomic_load(&stat_read_max_ns) / 1000.0);
+    printf("WheelSpeed: channel skew mean %.1f us, max %.1f us (%s)\n",
+        atomic_load(&stat_skew_total_ns) / 1000.0 / samples,
+        atomic_load(&stat_skew_max_ns) / 1000.0,
+        WHEEL_SPEED_LATCHED ? "latched" : "sequential");
+    getLS7336RStats(&encoder);
+    if (encoder.reads > 0) {
+        printf("WheelSpeed: LS7366R %u reads, %u errors, latency last %.1f us, mean %.1f us, max %.1f us\n",
+            encoder.reads, encoder.errors, encoder.last_ns / 1000.0,
+            encoder.total_ns / 1000.0 / encoder.reads, encoder.max_ns / 1000.0);
+        printf("WheelSpeed: LS7366R %u late reads could not be unwrapped for certain, %u counters widened\n",
+            encoder.ambiguous, encoder.widened);
+    }
+    if (WheelSpeed_Latest(&sample)) {
+        printf("WheelSpeed: left %.2f rev/s (%.1f cm/s), right %.2f rev/s (%.1f cm/s)\n",
+            sample.rev_s[WHEEL_LEFT], sample.cm_s[WHEEL_LEFT],
+            sample.rev_s[WHEEL_RIGHT], sample.cm_s[WHEEL_RIGHT]);
+#if WHEEL_SPEED_LATCHED
+        printf("WheelSpeed: counter wraps left %u, right %u, sign left %c, right %c\n",
+            atomic_load(&stat_wraps[WHEEL_LEFT]), atomic_load(&stat_wraps[WHEEL_RIGHT]),
+            (sample.status[WHEEL_LEFT] & STATUS_S) ? '-' : '+',
+            (sample.status[WHEEL_RIGHT] & STATUS_S) ? '-' : '+');
+#endif
+    }
+}
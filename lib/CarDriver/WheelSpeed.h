@@ -0,0 +1,75 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         WheelSpeed.h
+*
+* Description:
+*   Declarations for the wheel velocity service, which samples both 
+*   LS7366R encoder counters at a fixed rate and publishes filtered 
+*   wheel speeds.
+******************************************************************************/
+
+#ifndef _WHEEL_SPEED_H
+#define _WHEEL_SPEED_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define WHEEL_LEFT      0
+#define WHEEL_RIGHT     1
+#define NUM_WHEELS      2
+
+#define WHEEL_SPEED_SAMPLE_HZ   200     /* Encoder sampling rate */
+#define WHEEL_SPEED_RING_LEN    64      /* Samples kept, must be a power of two */
+#define WHEEL_SPEED_WINDOW      10      /* Samples spanned by each velocity estimate */
+#define WHEEL_SPEED_ALPHA       0.3f    /* Weight of a new estimate in the low-pass filter */
+#define WHEEL_SPEED_MAX_REV_S   5.0f    /* Fastest wheel speed, sets the counter width */
+
+/* Latch both counters together with LOAD_OTR before reading them,
+ * rather than reading each counter in turn */
+#define WHEEL_SPEED_LATCHED     1
+
+/* The motors are mounted in opposite orientations, so one encoder 
+ * counts down while the car drives forward. */
+#define WHEEL_SIGN_LEFT     1
+#define WHEEL_SIGN_RIGHT    (-1)
+
+typedef struct {
+    uint32_t seq;               /* Sample number */
+    uint64_t stamp_ns;          /* Monotonic time the counters were read */
+    int64_t count[NUM_WHEELS];  /* Unwrapped encoder counts, positive is forward */
+    uint8_t status[NUM_WHEELS]; /* LS7366R status flags (latched mode only) */
+    uint32_t skew_ns;           /* Time between sampling the two counters */
+    float rev_s[NUM_WHEELS];    /* Filtered wheel speed in revolutions per second */
+    float cm_s[NUM_WHEELS];     /* Filtered ground speed of each wheel */
+} WheelSample;
+
+/* Called from the sampling thread after each new sample */
+typedef void (*WheelSampleListener)(const WheelSample* sample, void* arg);
+
+typedef struct {
+    int chip_enable[NUM_WHEELS];            /* LS7366R chip select of each wheel */
+    WheelSampleListener listener;
+    void* listener_arg;
+} WheelSpeedConfig;
+
+int WheelSpeed_Start(const WheelSpeedConfig* config);
+void WheelSpeed_Stop(void);
+
+bool WheelSpeed_Latest(WheelSample* sample);
+bool WheelSpeed_History(uint32_t age, WheelSample* sample);
+
+float WheelSpeed_RevPerSec(int wheel);
+float WheelSpeed_CmPerSec(int wheel);
+void WheelSpeed_PrintStats(void);
+
+
+#endif  /* _WHEEL_SPEED_H */
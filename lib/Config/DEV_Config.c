@@ -241,15 +241,16 @@ void DEV_I2C_Init(uint8_t Add)
         
     #elif USE_DEV_LIB
         // printf("DEV I2C Device\r\n"); 
+        // The bus is only opened once, later calls just select Add
         DEV_HARDWARE_I2C_begin("/dev/i2c-1");
         DEV_HARDWARE_I2C_setSlaveAddress(Add);
     #endif
 #endif
 }
 
-void I2C_Write_Byte(uint8_t Cmd, uint8_t value)
+int I2C_Write_Byte(uint8_t Cmd, uint8_t value)
 {
-	int ref;
+	int ref = 0;
 #if DEV_I2C
     #ifdef USE_BCM2835_LIB
         char wbuf[2]={Cmd, value};
@@ -264,10 +265,73 @@ void I2C_Write_Byte(uint8_t Cmd, uint8_t value)
         }
     #elif USE_DEV_LIB
         char wbuf[2]={Cmd, value};
-        DEV_HARDWARE_I2C_write(wbuf, 2);
+        if (DEV_HARDWARE_I2C_write(wbuf, 2) != 0)
+            ref = -1;
 
     #endif
 #endif
+    return ref;
+}
+
+/**
+ * Write Len bytes starting at register Cmd in a single transaction.
+ * The slave must auto-increment its register pointer for this to
+ * land in consecutive registers.
+**/
+int I2C_Write_nByte(uint8_t Cmd, uint8_t *pData, uint32_t Len)
+{
+    int ref = 0;
+#if DEV_I2C
+    #ifdef USE_BCM2835_LIB
+        char wbuf[Len + 1];
+        wbuf[0] = Cmd;
+        memcpy(&wbuf[1], pData, Len);
+        bcm2835_i2c_write(wbuf, Len + 1);
+    #elif USE_WIRINGPI_LIB
+        uint32_t i;
+        for(i = 0; i < Len; i++) {
+            ref |= I2C_Write_Byte(Cmd + i, pData[i]);
+        }
+    #elif USE_DEV_LIB
+        char wbuf[Len + 1];
+        wbuf[0] = Cmd;
+        memcpy(&wbuf[1], pData, Len);
+        if (DEV_HARDWARE_I2C_write(wbuf, Len + 1) != 0)
+            ref = -1;
+    #endif
+#endif
+    return ref;
+}
+
+/**
+ * Write Len unrelated registers, Cmds[i] = values[i], in order.
+ * With the dev library all writes share one combined transfer
+ * (repeated starts, one STOP) instead of one transaction each.
+**/
+int I2C_Write_Bytes(uint8_t *Cmds, uint8_t *values, uint32_t Len)
+{
+    int ref = 0;
+    uint32_t i;
+#if DEV_I2C
+    #ifdef USE_DEV_LIB
+        char wbuf[Len][2];
+        HARDWARE_I2C_MSG msgs[Len];
+        for(i = 0; i < Len; i++) {
+            wbuf[i][0] = Cmds[i];
+            wbuf[i][1] = values[i];
+            msgs[i].flags = 0;
+            msgs[i].len = 2;
+            msgs[i].buf = wbuf[i];
+        }
+        if (DEV_HARDWARE_I2C_transfer(msgs, Len) != 0)
+            ref = -1;
+    #else
+        for(i = 0; i < Len; i++) {
+            ref |= I2C_Write_Byte(Cmds[i], values[i]);
+        }
+    #endif
+#endif
+    return ref;
 }
 
 int I2C_Read_Byte(uint8_t Cmd)
@@ -284,8 +348,9 @@ int I2C_Read_Byte(uint8_t Cmd)
         
     #elif USE_DEV_LIB
         char rbuf[2]={0};
-        DEV_HARDWARE_I2C_read(Cmd, rbuf, 1);
-        ref = rbuf[0];
+        if (DEV_HARDWARE_I2C_read(Cmd, rbuf, 1) != 0)
+            return -1;
+        ref = (uint8_t)rbuf[0];
     #endif
 #endif
     return ref;
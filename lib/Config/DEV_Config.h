@@ -44,7 +44,9 @@ uint8_t DEV_ModuleInit(void);
 void    DEV_ModuleExit(void);
 
 void DEV_I2C_Init(uint8_t Add);
-void I2C_Write_Byte(uint8_t Cmd, uint8_t value);
+int I2C_Write_Byte(uint8_t Cmd, uint8_t value);
+int I2C_Write_nByte(uint8_t Cmd, uint8_t *pData, uint32_t Len);
+int I2C_Write_Bytes(uint8_t *Cmds, uint8_t *values, uint32_t Len);
 int I2C_Read_Byte(uint8_t Cmd);
 int I2C_Read_Word(uint8_t Cmd);
 
@@ -38,6 +38,7 @@
 #include <unistd.h> 
 #include <stdio.h> 
 #include <stdlib.h> 
+#include <string.h> 
 #include <getopt.h> 
 #include <fcntl.h> 
 #include <sys/ioctl.h> 
@@ -360,3 +361,130 @@ int DEV_HARDWARE_SPI_Transfer(uint8_t *buf, uint32_t len)
     return 1;
 }
 
+/******************************************************************************
+function:   Open an SPI device handle
+parameter:
+    dev        : Device handle to fill in
+    SPI_device : Device name
+    mode       : SPI mode
+    speed      : Clock speed (Hz)
+Info:
+    Unlike DEV_HARDWARE_SPI_begin, a failure is returned rather than
+    exiting, and the global hardware_SPI device is left alone.
+    Return 1 success
+    Return -1 failed
+******************************************************************************/
+int DEV_HARDWARE_SPI_devOpen(HARDWARE_SPI_DEV *dev, char *SPI_device, SPIMode mode, uint32_t speed)
+{
+    dev->mode = mode;
+    dev->speed = speed;
+#if DEV_HARDWARE_SPI_MOCK
+    dev->fd = -1;
+    DEV_HARDWARE_SPI_Debug("mock : %s\r\n", SPI_device);
+    return 1;
+#else
+    if((dev->fd = open(SPI_device, O_RDWR)) < 0) {
+        perror("Failed to open SPI device.\n");
+        return -1;
+    }
+    DEV_HARDWARE_SPI_Debug("open : %s\r\n", SPI_device);
+
+    if (ioctl(dev->fd, SPI_IOC_WR_BITS_PER_WORD, &bits) == -1
+        || ioctl(dev->fd, SPI_IOC_WR_MODE, &dev->mode) == -1
+        || DEV_HARDWARE_SPI_devSetSpeed(dev, speed) < 0) {
+        DEV_HARDWARE_SPI_Debug("can't configure %s\r\n", SPI_device);
+        close(dev->fd);
+        dev->fd = -1;
+        return -1;
+    }
+    return 1;
+#endif
+}
+
+/******************************************************************************
+function:   Close an SPI device handle
+parameter:
+Info:
+******************************************************************************/
+void DEV_HARDWARE_SPI_devClose(HARDWARE_SPI_DEV *dev)
+{
+#if !DEV_HARDWARE_SPI_MOCK
+    if (dev->fd >= 0 && close(dev->fd) != 0) {
+        perror("Failed to close SPI device.\n");
+    }
+#endif
+    dev->fd = -1;
+}
+
+/******************************************************************************
+function:   Set the clock speed of an SPI device handle
+parameter:
+Info:   The speed actually used by the driver is read back,
+        since it may round the requested speed down.
+        Return 1 success
+        Return -1 failed
+******************************************************************************/
+int DEV_HARDWARE_SPI_devSetSpeed(HARDWARE_SPI_DEV *dev, uint32_t speed)
+{
+#if !DEV_HARDWARE_SPI_MOCK
+    if (ioctl(dev->fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed) == -1
+        || ioctl(dev->fd, SPI_IOC_RD_MAX_SPEED_HZ, &speed) == -1) {
+        DEV_HARDWARE_SPI_Debug("can't set max speed hz\r\n");
+        return -1;
+    }
+#endif
+    dev->speed = speed;
+    return 1;
+}
+
+/******************************************************************************
+function:   Send several transfers to an SPI device in one message
+parameter:
+    dev    : Device handle
+    xfers  : Transfers, in order. A NULL rx_buf discards the data read,
+             a NULL tx_buf sends zeros
+    count  : Number of transfers, at most DEV_HARDWARE_SPI_MAX_XFERS
+Info:
+    All transfers go to the driver in a single SPI_IOC_MESSAGE ioctl.
+    Chip select stays asserted between transfers unless cs_change is set.
+    Return 1 success
+    Return -1 failed
+******************************************************************************/
+int DEV_HARDWARE_SPI_devTransfer(HARDWARE_SPI_DEV *dev, HARDWARE_SPI_XFER *xfers, uint32_t count)
+{
+    uint32_t i;
+
+    if (count == 0 || count > DEV_HARDWARE_SPI_MAX_XFERS) {
+        return -1;
+    }
+#if DEV_HARDWARE_SPI_MOCK
+    for (i = 0; i < count; i++) {
+        if (xfers[i].rx_buf == NULL) {
+            continue;
+        }
+        if (xfers[i].tx_buf != NULL) {
+            memmove(xfers[i].rx_buf, xfers[i].tx_buf, xfers[i].len);
+        } else {
+            memset(xfers[i].rx_buf, 0, xfers[i].len);
+        }
+    }
+    return 1;
+#else
+    struct spi_ioc_transfer msg[DEV_HARDWARE_SPI_MAX_XFERS];
+
+    memset(msg, 0, sizeof(msg));
+    for (i = 0; i < count; i++) {
+        msg[i].tx_buf = (unsigned long)xfers[i].tx_buf;
+        msg[i].rx_buf = (unsigned long)xfers[i].rx_buf;
+        msg[i].len = xfers[i].len;
+        msg[i].speed_hz = dev->speed;
+        msg[i].bits_per_word = bits;
+        msg[i].cs_change = xfers[i].cs_change;
+    }
+    if (ioctl(dev->fd, SPI_IOC_MESSAGE(count), msg) < 1) {
+        DEV_HARDWARE_SPI_Debug("can't send spi message\r\n");
+        return -1;
+    }
+    return 1;
+#endif
+}
@@ -40,6 +40,14 @@
 #define DEV_HARDWARE_SPI_Debug(__info,...)
 #endif
 
+/**
+ * Build with DEV_HARDWARE_SPI_MOCK=1 to replace /dev/spidev* with a
+ * loopback device (MISO reads back MOSI), so SPI code can run off target.
+**/
+#ifndef DEV_HARDWARE_SPI_MOCK
+#define DEV_HARDWARE_SPI_MOCK 0
+#endif
+
 #define SPI_CPHA        0x01
 #define SPI_CPOL        0x02
 #define SPI_MODE_0      (0|0)
@@ -97,6 +105,28 @@ typedef struct SPIStruct {
     int fd; //
 } HARDWARE_SPI;
 
+/**
+ * One SPI device on its own /dev/spidevB.C node. Each chip select
+ * has its own node, so several devices can be used side by side.
+**/
+typedef struct SPIDevStruct {
+    int fd;
+    uint32_t speed;
+    uint8_t mode;
+} HARDWARE_SPI_DEV;
+
+/**
+ * One transfer of a multi-transfer message
+**/
+typedef struct SPIXferStruct {
+    const uint8_t *tx_buf;
+    uint8_t *rx_buf;
+    uint32_t len;
+    uint8_t cs_change; //release chip select after this transfer
+} HARDWARE_SPI_XFER;
+
+#define DEV_HARDWARE_SPI_MAX_XFERS 8
+
 void DEV_HARDWARE_SPI_begin(char *SPI_device);
 void DEV_HARDWARE_SPI_beginSet(char *SPI_device, SPIMode mode, uint32_t speed);
 void DEV_HARDWARE_SPI_end(void);
@@ -113,5 +143,10 @@ int DEV_HARDWARE_SPI_ChipSelect(SPIChipSelect CS_Mode);
 int DEV_HARDWARE_SPI_CSEN(SPICSEN EN);
 int DEV_HARDWARE_SPI_Mode(SPIMode mode);
 
+int DEV_HARDWARE_SPI_devOpen(HARDWARE_SPI_DEV *dev, char *SPI_device, SPIMode mode, uint32_t speed);
+void DEV_HARDWARE_SPI_devClose(HARDWARE_SPI_DEV *dev);
+int DEV_HARDWARE_SPI_devSetSpeed(HARDWARE_SPI_DEV *dev, uint32_t speed);
+int DEV_HARDWARE_SPI_devTransfer(HARDWARE_SPI_DEV *dev, HARDWARE_SPI_XFER *xfers, uint32_t count);
+
 
 #endif
\ No newline at end of file
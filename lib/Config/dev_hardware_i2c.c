@@ -33,22 +33,42 @@
 #include <stdio.h>
 #include <stdlib.h>   //exit()  
 #include <fcntl.h>    //define O_RDWR  
+#include <linux/i2c.h>      //struct i2c_msg
 #include <linux/i2c-dev.h>  
 #include <sys/ioctl.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 
+#define I2C_ADDR_NONE 0xFFFF    //I2C_SLAVE has not been set yet
 
-HARDWARE_I2C hardware_i2c;
+HARDWARE_I2C hardware_i2c = {
+    .fd = -1,
+    .addr = I2C_ADDR_NONE,
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+static HARDWARE_I2C_DEV hardware_i2c_devs[128];
+static HARDWARE_I2C_STATS hardware_i2c_stats;
 
 /******************************************************************************
 function: I2C device initialization
 parameter:
     i2c_device : Device name
 Info:   /dev/i2c-*
+        The adapter is opened once and shared by every device handle,
+        calling this again while it is open does nothing.
 ******************************************************************************/
 void DEV_HARDWARE_I2C_begin(char *i2c_device)
 {
+    pthread_mutex_lock(&hardware_i2c.lock);
+    if (hardware_i2c.is_open) {
+        pthread_mutex_unlock(&hardware_i2c.lock);
+        return;
+    }
+#if DEV_HARDWARE_I2C_MOCK
+    memset(hardware_i2c_devs, 0, sizeof(hardware_i2c_devs));
+    DEV_HARDWARE_I2C_Debug("mock : %s\r\n", i2c_device);
+#else
     //device
     if((hardware_i2c.fd = open(i2c_device, O_RDWR)) < 0)  { //打开I2C 
         perror("Failed to open i2c device.\n");  
@@ -57,59 +77,355 @@ void DEV_HARDWARE_I2C_begin(char *i2c_device)
     } else {
         DEV_HARDWARE_I2C_Debug("open : %s\r\n", i2c_device);
     }
+#endif
+    hardware_i2c.addr = I2C_ADDR_NONE;
+    hardware_i2c.is_open = 1;
+    pthread_mutex_unlock(&hardware_i2c.lock);
 }
 
 /******************************************************************************
 function: I2C device End
 parameter:
-Info:
+Info:   Device handles must not be used after this
 ******************************************************************************/
 void DEV_HARDWARE_I2C_end(void)
 {
-    if (close(hardware_i2c.fd) != 0){
-        perror("Failed to close i2c device.\n");  
+    pthread_mutex_lock(&hardware_i2c.lock);
+    if (hardware_i2c.is_open) {
+#if !DEV_HARDWARE_I2C_MOCK
+        if (close(hardware_i2c.fd) != 0){
+            perror("Failed to close i2c device.\n");  
+        }
+#endif
+        hardware_i2c.fd = -1;
+        hardware_i2c.is_open = 0;
+        hardware_i2c.dev = NULL;
     }
+    pthread_mutex_unlock(&hardware_i2c.lock);
+}
+
+/******************************************************************************
+function: Get the handle of one device on the bus
+parameter:
+    addr : 7-bit device address
+Info:   Handles share the bus file descriptor. Every transfer through a
+        handle holds the bus lock, so handles may be used from any thread.
+******************************************************************************/
+HARDWARE_I2C_DEV *DEV_HARDWARE_I2C_device(uint8_t addr)
+{
+    HARDWARE_I2C_DEV *dev = &hardware_i2c_devs[addr & 0x7F];
+    dev->addr = addr & 0x7F;
+    return dev;
 }
 
 /******************************************************************************
 function: Set the device address for I2C access
 parameter:
     addr : Device address accessed by I2C
-Info:
+Info:   Selects the device used by DEV_HARDWARE_I2C_write/read/transfer.
+        Drivers shared between threads should hold their own handle from
+        DEV_HARDWARE_I2C_device instead, since any later call changes it.
 ******************************************************************************/
 void DEV_HARDWARE_I2C_setSlaveAddress(uint8_t addr)
 {
-    if(ioctl(hardware_i2c.fd, I2C_SLAVE, addr) < 0)  {  
+    HARDWARE_I2C_DEV *dev = DEV_HARDWARE_I2C_device(addr);
+
+    pthread_mutex_lock(&hardware_i2c.lock);
+    hardware_i2c.dev = dev;
+    pthread_mutex_unlock(&hardware_i2c.lock);
+}
+
+/******************************************************************************
+function: Get the device selected with DEV_HARDWARE_I2C_setSlaveAddress
+Info:   The bus lock must be held, and kept until the transfer with the
+        device is done, so another thread can't select a different one
+        in between.
+        NULL, and counted as an error, if none has been selected yet
+******************************************************************************/
+static HARDWARE_I2C_DEV *DEV_HARDWARE_I2C_selected(void)
+{
+    HARDWARE_I2C_DEV *dev = hardware_i2c.dev;
+
+    if (dev == NULL) {
+        hardware_i2c_stats.errors++;
+        DEV_HARDWARE_I2C_Debug("no device selected\r\n");
+    }
+    return dev;
+}
+
+/******************************************************************************
+function: Point the adapter at a device for plain read()/write()
+parameter:
+    dev : Device handle
+Info:   The bus lock must be held. The ioctl is only issued when the
+        address actually changes.
+******************************************************************************/
+static uint8_t DEV_HARDWARE_I2C_select(HARDWARE_I2C_DEV *dev)
+{
+    if (hardware_i2c.addr == dev->addr) {
+        return 0;
+    }
+#if !DEV_HARDWARE_I2C_MOCK
+    if(ioctl(hardware_i2c.fd, I2C_SLAVE, dev->addr) < 0)  {  
         printf("Failed to access bus.\n");  
-        exit(1);  
+        hardware_i2c.addr = I2C_ADDR_NONE;
+        return 1;
+    }
+#endif
+    hardware_i2c.addr = dev->addr;
+    hardware_i2c_stats.slave_switches++;
+    return 0;
+}
+
+#if DEV_HARDWARE_I2C_MOCK
+static void DEV_HARDWARE_I2C_mockWrite(HARDWARE_I2C_DEV *dev, const char *buf, uint32_t len)
+{
+    uint32_t i;
+    if (len > 0) {
+        dev->mock_ptr = buf[0];
+        for (i = 1; i < len; i++) {
+            dev->mock_regs[dev->mock_ptr++] = buf[i];
+        }
     }
 }
 
+static void DEV_HARDWARE_I2C_mockRead(HARDWARE_I2C_DEV *dev, char *buf, uint32_t len)
+{
+    uint32_t i;
+    for (i = 0; i < len; i++) {
+        buf[i] = dev->mock_regs[dev->mock_ptr++];
+    }
+}
+#endif
+
 /******************************************************************************
-function:   I2C Send data
+function:   I2C Send data to one device, with the bus lock held
 parameter:
+    dev  : Device handle
     buf  : Send data buffer address
     len  : Send data length
-Info:
+Info:   Return 0 success
+        Return 1 failed or short write
+******************************************************************************/
+static uint8_t DEV_HARDWARE_I2C_writeLocked(HARDWARE_I2C_DEV *dev, const char * buf, uint32_t len)
+{
+    uint8_t ret = 0;
+
+    hardware_i2c_stats.transactions++;
+    hardware_i2c_stats.bytes += len;
+#if DEV_HARDWARE_I2C_MOCK
+    DEV_HARDWARE_I2C_select(dev);
+    DEV_HARDWARE_I2C_mockWrite(dev, buf, len);
+#else
+    if (DEV_HARDWARE_I2C_select(dev) != 0
+        || write(hardware_i2c.fd, buf, len) != (ssize_t)len) {
+        hardware_i2c_stats.errors++;
+        DEV_HARDWARE_I2C_Debug("write failed\r\n");
+        ret = 1;
+    }
+#endif
+    return ret;
+}
+
+/******************************************************************************
+function:   I2C combined transfer with one device, with the bus lock held
+parameter:
+    dev   : Device handle
+    msgs  : Messages to send, in order
+    count : Number of messages (at most I2C_RDWR_IOCTL_MAX_MSGS)
+Info:   Return 0 success
+        Return 1 failed or fewer messages transferred than requested
+******************************************************************************/
+static uint8_t DEV_HARDWARE_I2C_transferLocked(HARDWARE_I2C_DEV *dev, HARDWARE_I2C_MSG *msgs, uint32_t count)
+{
+    uint32_t i;
+    uint8_t ret = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+    if (count > I2C_RDWR_IOCTL_MAX_MSGS) {
+        hardware_i2c_stats.errors++;
+        DEV_HARDWARE_I2C_Debug("too many messages : %d\r\n", count);
+        return 1;
+    }
+    hardware_i2c_stats.transactions++;
+    for (i = 0; i < count; i++) {
+        hardware_i2c_stats.bytes += msgs[i].len;
+    }
+
+#if DEV_HARDWARE_I2C_MOCK
+    for (i = 0; i < count; i++) {
+        if (msgs[i].flags & DEV_HARDWARE_I2C_M_RD) {
+            DEV_HARDWARE_I2C_mockRead(dev, msgs[i].buf, msgs[i].len);
+        } else {
+            DEV_HARDWARE_I2C_mockWrite(dev, msgs[i].buf, msgs[i].len);
+        }
+    }
+#else
+    struct i2c_msg i2c_msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+    struct i2c_rdwr_ioctl_data data;
+
+    for (i = 0; i < count; i++) {
+        i2c_msgs[i].addr = dev->addr;
+        i2c_msgs[i].flags = (msgs[i].flags & DEV_HARDWARE_I2C_M_RD) ? I2C_M_RD : 0;
+        i2c_msgs[i].len = msgs[i].len;
+        i2c_msgs[i].buf = (uint8_t *)msgs[i].buf;
+    }
+    data.msgs = i2c_msgs;
+    data.nmsgs = count;
+
+    if (ioctl(hardware_i2c.fd, I2C_RDWR, &data) != (int)count) {
+        hardware_i2c_stats.errors++;
+        DEV_HARDWARE_I2C_Debug("transfer failed\r\n");
+        ret = 1;
+    }
+#endif
+    return ret;
+}
+
+/******************************************************************************
+function:   I2C Send data to one device
+parameter:
+    dev  : Device handle
+    buf  : Send data buffer address
+    len  : Send data length
+Info:   Return 0 success
+        Return 1 failed or short write
+******************************************************************************/
+uint8_t DEV_HARDWARE_I2C_devWrite(HARDWARE_I2C_DEV *dev, const char * buf, uint32_t len)
+{
+    uint8_t ret;
+
+    pthread_mutex_lock(&hardware_i2c.lock);
+    ret = DEV_HARDWARE_I2C_writeLocked(dev, buf, len);
+    pthread_mutex_unlock(&hardware_i2c.lock);
+    return ret;
+}
+
+/******************************************************************************
+function:   I2C read data from one device
+parameter:
+    dev  : Device handle
+    reg  : Read data register address
+    buf  : Sead data buffer address
+    len  : Sead data length
+Info:   The register address is sent with a repeated start instead of a
+        STOP, so the whole read is one bus transaction and one syscall.
+        Return 0 success
+        Return 1 failed or short read
+******************************************************************************/
+uint8_t DEV_HARDWARE_I2C_devRead(HARDWARE_I2C_DEV *dev, uint8_t reg, char* buf, uint32_t len)
+{
+    HARDWARE_I2C_MSG msgs[2] = {
+        { 0, 1, (char *)&reg },
+        { DEV_HARDWARE_I2C_M_RD, len, buf },
+    };
+    return DEV_HARDWARE_I2C_devTransfer(dev, msgs, 2);
+}
+
+/******************************************************************************
+function:   I2C combined transfer with one device
+parameter:
+    dev   : Device handle
+    msgs  : Messages to send, in order
+    count : Number of messages (at most I2C_RDWR_IOCTL_MAX_MSGS)
+Info:   All messages go out in one I2C_RDWR ioctl, joined by repeated
+        starts. A write message starts with the register address.
+        The address travels with each message, so I2C_SLAVE is untouched.
+        Return 0 success
+        Return 1 failed or fewer messages transferred than requested
+******************************************************************************/
+uint8_t DEV_HARDWARE_I2C_devTransfer(HARDWARE_I2C_DEV *dev, HARDWARE_I2C_MSG *msgs, uint32_t count)
+{
+    uint8_t ret;
+
+    pthread_mutex_lock(&hardware_i2c.lock);
+    ret = DEV_HARDWARE_I2C_transferLocked(dev, msgs, count);
+    pthread_mutex_unlock(&hardware_i2c.lock);
+    return ret;
+}
+
+/******************************************************************************
+function:   I2C Send data to the selected device
+parameter:
+    buf  : Send data buffer address
+    len  : Send data length
+Info:   See DEV_HARDWARE_I2C_setSlaveAddress
 ******************************************************************************/
 uint8_t DEV_HARDWARE_I2C_write(const char * buf, uint32_t len)
 {
-    write(hardware_i2c.fd, buf, len);
-    return 0;
+    HARDWARE_I2C_DEV *dev;
+    uint8_t ret = 1;
+
+    pthread_mutex_lock(&hardware_i2c.lock);
+    dev = DEV_HARDWARE_I2C_selected();
+    if (dev != NULL) {
+        ret = DEV_HARDWARE_I2C_writeLocked(dev, buf, len);
+    }
+    pthread_mutex_unlock(&hardware_i2c.lock);
+    return ret;
 }
 
 /******************************************************************************
-function:   I2C read data
+function:   I2C read data from the selected device
 parameter:
     reg  : Read data register address
     buf  : Sead data buffer address
     len  : Sead data length
-Info:
+Info:   See DEV_HARDWARE_I2C_setSlaveAddress
 ******************************************************************************/
 uint8_t DEV_HARDWARE_I2C_read(uint8_t reg, char* buf, uint32_t len)
 {
-    uint8_t temp[1] = {reg};
-    write(hardware_i2c.fd, temp, 1); 
-    read(hardware_i2c.fd, buf, len);
-    return 0;
-}
\ No newline at end of file
+    HARDWARE_I2C_MSG msgs[2] = {
+        { 0, 1, (char *)&reg },
+        { DEV_HARDWARE_I2C_M_RD, len, buf },
+    };
+    return DEV_HARDWARE_I2C_transfer(msgs, 2);
+}
+
+/******************************************************************************
+function:   I2C combined transfer with the selected device
+parameter:
+    msgs  : Messages to send, in order
+    count : Number of messages
+Info:   See DEV_HARDWARE_I2C_setSlaveAddress
+******************************************************************************/
+uint8_t DEV_HARDWARE_I2C_transfer(HARDWARE_I2C_MSG *msgs, uint32_t count)
+{
+    HARDWARE_I2C_DEV *dev;
+    uint8_t ret = 1;
+
+    pthread_mutex_lock(&hardware_i2c.lock);
+    dev = DEV_HARDWARE_I2C_selected();
+    if (dev != NULL) {
+        ret = DEV_HARDWARE_I2C_transferLocked(dev, msgs, count);
+    }
+    pthread_mutex_unlock(&hardware_i2c.lock);
+    return ret;
+}
+
+/******************************************************************************
+function:   Get the bus traffic counters
+parameter:
+    stats : Receives a copy of the counters
+Info:   Counts are kept for the real device and the mock alike
+******************************************************************************/
+void DEV_HARDWARE_I2C_getStats(HARDWARE_I2C_STATS *stats)
+{
+    pthread_mutex_lock(&hardware_i2c.lock);
+    *stats = hardware_i2c_stats;
+    pthread_mutex_unlock(&hardware_i2c.lock);
+}
+
+/******************************************************************************
+function:   Reset the bus traffic counters
+parameter:
+Info:
+******************************************************************************/
+void DEV_HARDWARE_I2C_resetStats(void)
+{
+    pthread_mutex_lock(&hardware_i2c.lock);
+    memset(&hardware_i2c_stats, 0, sizeof(hardware_i2c_stats));
+    pthread_mutex_unlock(&hardware_i2c.lock);
+}
@@ -32,6 +32,7 @@
 #define __DEV_HARDWARE_I2C_
 
 #include <stdint.h>
+#include <pthread.h>
 
 
 #define DEV_HARDWARE_I2C_DEBUG 0
@@ -41,6 +42,25 @@
 #define DEV_HARDWARE_I2C_Debug(__info,...)
 #endif
 
+/**
+ * Build with DEV_HARDWARE_I2C_MOCK=1 to replace /dev/i2c-* with an
+ * in-memory register file, so bus traffic can be measured off target.
+**/
+#ifndef DEV_HARDWARE_I2C_MOCK
+#define DEV_HARDWARE_I2C_MOCK 0
+#endif
+
+/**
+ * One slave device on the bus
+**/
+typedef struct I2CDevStruct {
+    uint16_t addr; //I2C device address
+#if DEV_HARDWARE_I2C_MOCK
+    uint8_t mock_regs[256]; //register file with an auto-incrementing pointer,
+    uint8_t mock_ptr;       //like the PCA9685 with MODE1.AI set
+#endif
+} HARDWARE_I2C_DEV;
+
 /**
  * Define I2C attribute
 **/
@@ -49,13 +69,44 @@ typedef struct I2CStruct {
     uint16_t SCL_PIN;
     uint16_t SDA_PIN;
     
-    int fd; //I2C device file descriptor
-    uint16_t addr; //I2C device address
+    int fd; //I2C device file descriptor, shared by all devices
+    uint16_t addr; //address last set with I2C_SLAVE
+    uint8_t is_open;
+    pthread_mutex_t lock; //serializes access to the bus
+    HARDWARE_I2C_DEV *dev; //device used by write/read/transfer, set under lock
 } HARDWARE_I2C;
 
+/**
+ * One message of a combined transfer
+**/
+#define DEV_HARDWARE_I2C_M_RD 0x01  //read from the slave, otherwise write
+
+typedef struct I2CMsgStruct {
+    uint16_t flags;
+    uint16_t len;
+    char *buf;
+} HARDWARE_I2C_MSG;
+
+/**
+ * Bus traffic counters
+**/
+typedef struct I2CStatsStruct {
+    uint32_t transactions; //number of START..STOP bus transactions
+    uint32_t bytes;        //data bytes on the wire, excluding the address byte
+    uint32_t errors;       //failed or short transfers
+    uint32_t slave_switches; //I2C_SLAVE ioctls issued
+} HARDWARE_I2C_STATS;
+
 void DEV_HARDWARE_I2C_begin(char *i2c_device);
 void DEV_HARDWARE_I2C_end(void);
 void DEV_HARDWARE_I2C_setSlaveAddress(uint8_t addr);
+HARDWARE_I2C_DEV *DEV_HARDWARE_I2C_device(uint8_t addr);
+uint8_t DEV_HARDWARE_I2C_devWrite(HARDWARE_I2C_DEV *dev, const char * buf, uint32_t len);
+uint8_t DEV_HARDWARE_I2C_devRead(HARDWARE_I2C_DEV *dev, uint8_t reg, char* buf, uint32_t len);
+uint8_t DEV_HARDWARE_I2C_devTransfer(HARDWARE_I2C_DEV *dev, HARDWARE_I2C_MSG *msgs, uint32_t count);
 uint8_t DEV_HARDWARE_I2C_write(const char * buf, uint32_t len);
 uint8_t DEV_HARDWARE_I2C_read(uint8_t reg, char* buf, uint32_t len);
+uint8_t DEV_HARDWARE_I2C_transfer(HARDWARE_I2C_MSG *msgs, uint32_t count);
+void DEV_HARDWARE_I2C_getStats(HARDWARE_I2C_STATS *stats);
+void DEV_HARDWARE_I2C_resetStats(void);
 #endif
\ No newline at end of file
@@ -0,0 +1,357 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         MotorActuator.c
+*
+* Description:
+*   Actuator thread for the motor driver. Commands are passed from the
+*   control loop through a lock-free single-producer queue. Only the
+*   newest command matters, so the actuator thread skips straight to it
+*   and counts the older ones as coalesced.
+******************************************************************************/
+
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "MotorActuator.h"
+#include "Timing.h"
+
+
+static MotorCommand queue[ACTUATOR_QUEUE_LEN];
+static atomic_uint queue_head;      /* Next slot to publish, written by the producer */
+static atomic_uint queue_tail;      /* Oldest unread slot */
+
+static sem_t wake;                  /* Posted once per published command */
+static pthread_t actuator_thread;
+static atomic_bool running;
+
+static atomic_uint stat_published;
+static atomic_uint stat_applied;
+static atomic_uint stat_coalesced;
+static atomic_uint stat_max_depth;
+static atomic_ullong stat_latency_last_ns;
+static atomic_ullong stat_latency_max_ns;
+static atomic_ullong stat_latency_total_ns;
+static atomic_uint stat_updates;
+static _Atomic float stat_target[2];
+static _Atomic float stat_actual[2];
+
+
+/**
+ * Split a command direction into the direction each wheel turns
+ * relative to the car, FORWARD or BACKWARD.
+ */
+static void wheel_directions(DIR dir, DIR wheel_dir[2])
+{
+    switch (dir)
+    {
+        case LEFT:
+            wheel_dir[MOTOR_LEFT] = BACKWARD;
+            wheel_dir[MOTOR_RIGHT] = FORWARD;
+            break;
+        case RIGHT:
+            wheel_dir[MOTOR_LEFT] = FORWARD;
+            wheel_dir[MOTOR_RIGHT] = BACKWARD;
+            break;
+        case BACKWARD:
+            wheel_dir[MOTOR_LEFT] = BACKWARD;
+            wheel_dir[MOTOR_RIGHT] = BACKWARD;
+            break;
+        default:
+            wheel_dir[MOTOR_LEFT] = FORWARD;
+            wheel_dir[MOTOR_RIGHT] = FORWARD;
+            break;
+    }
+}
+
+/**
+ * Write both wheels in one PCA9685 frame, respecting the mounting
+ * orientation of each motor.
+ */
+static void apply_output(const DIR wheel_dir[2], UWORD speed_left, UWORD speed_right)
+{
+    Motor_Run_Both(
+        wheel_dir[MOTOR_LEFT] == FORWARD ? MOTOR_LEFT_FORWARD : MOTOR_LEFT_BACKWARD, speed_left,
+        wheel_dir[MOTOR_RIGHT] == FORWARD ? MOTOR_RIGHT_FORWARD : MOTOR_RIGHT_BACKWARD, speed_right);
+}
+
+/**
+ * Aim a wheel at its commanded speed and direction. A wheel which has
+ * to reverse is first slowed to a stop, and only turned around by
+ * reverse_at_stop once it gets there.
+ */
+static void set_wheel_target(MotorSlew* slew, DIR* applied_dir, DIR want_dir, float want_speed)
+{
+    if (want_dir != *applied_dir && slew->actual > 0.0f) {
+        Motor_Slew_Set_Target(slew, 0.0f);
+        return;
+    }
+    *applied_dir = want_dir;
+    Motor_Slew_Set_Target(slew, want_speed);
+}
+
+/**
+ * Turn a stopped wheel around once its reversal has ramped down to
+ * zero, and aim it at the commanded speed the other way.
+ */
+static void reverse_at_stop(MotorSlew* slew, DIR* applied_dir, DIR want_dir, float want_speed)
+{
+    if (want_dir != *applied_dir && slew->actual <= 0.0f) {
+        *applied_dir = want_dir;
+        Motor_Slew_Set_Target(slew, want_speed);
+    }
+}
+
+/**
+ * Wait for a command, or until the given monotonic deadline passes.
+ * A deadline of 0 waits for a command indefinitely.
+ *
+ * sem_timedwait only takes CLOCK_REALTIME, so the remaining time 
+ * is measured on the monotonic clock and converted each call.
+ */
+static void wait_for_command(uint64_t deadline_ns)
+{
+    struct timespec abs;
+
+    if (deadline_ns == 0) {
+        sem_wait(&wake);
+        return;
+    }
+    if (Timing_Expired(deadline_ns)) {
+        return;
+    }
+    Timing_RealtimeDeadline(deadline_ns, &abs);
+    sem_timedwait(&wake, &abs);
+}
+
+/**
+ * Take the newest command off the queue, discarding any older ones.
+ *
+ * The producer may advance the tail itself when the queue is full, so
+ * the tail is claimed with a compare-and-swap. The command is copied out
+ * before the claim; if the claim fails the slot may have been reused 
+ * and the copy is thrown away.
+ *
+ * Returns false if the queue was empty.
+ */
+static bool take_newest(MotorCommand* cmd)
+{
+    unsigned head, tail;
+
+    tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+    do {
+        head = atomic_load_explicit(&queue_head, memory_order_acquire);
+        if (head == tail) {
+            return false;
+        }
+        *cmd = queue[(head - 1) & (ACTUATOR_QUEUE_LEN - 1)];
+    } while (!atomic_compare_exchange_weak_explicit(&queue_tail, &tail, head,
+                memory_order_acq_rel, memory_order_acquire));
+
+    atomic_fetch_add_explicit(&stat_coalesced, head - tail - 1, memory_order_relaxed);
+    return true;
+}
+
+/**
+ * Thread routine which applies commands at the control tick rate.
+ *
+ * Commands only set the target duty cycles. Once per tick both slew
+ * limiters advance and, if anything changed, a single frame is written 
+ * for both motors. A wheel which changes direction decelerates to a
+ * stop before accelerating the other way. When the motors have reached
+ * their targets the thread sleeps until the next command arrives.
+ */
+static void* actuator_routine(void* arg)
+{
+    const uint64_t tick_ns = TIMING_NS_PER_S / ACTUATOR_TICK_HZ;
+    const float tick_s = 1.0f / ACTUATOR_TICK_HZ;
+
+    MotorSlew slew[2];
+    MotorCommand cmd;
+    DIR wheel_dir[2] = { FORWARD, FORWARD };    /* Direction each wheel is driven */
+    DIR want_dir[2] = { FORWARD, FORWARD };     /* Direction of the last command */
+    float want_speed[2] = { 0.0f, 0.0f };
+    bool pending = false;       /* A command arrived since the last tick */
+    uint64_t pending_stamp_ns = 0;
+    uint64_t next_tick_ns = 0;
+    uint64_t last_tick_ns = 0;
+    uint64_t now, latency;
+    float dt_s;
+    bool changed;
+
+    Motor_Slew_Init(&slew[MOTOR_LEFT], ACTUATOR_ACCEL_RATE, ACTUATOR_DECEL_RATE, 0.0f);
+    Motor_Slew_Init(&slew[MOTOR_RIGHT], ACTUATOR_ACCEL_RATE, ACTUATOR_DECEL_RATE, 0.0f);
+
+    while (atomic_load(&running))
+    {
+        if (pending || Motor_Slew_Busy(&slew[MOTOR_LEFT]) || Motor_Slew_Busy(&slew[MOTOR_RIGHT])) {
+            wait_for_command(next_tick_ns);
+        } else {
+            wait_for_command(0);
+        }
+
+        if (take_newest(&cmd)) {
+            wheel_directions(cmd.dir, want_dir);
+            want_speed[MOTOR_LEFT] = cmd.speed_left;
+            want_speed[MOTOR_RIGHT] = cmd.speed_right;
+            for (int i = 0; i < 2; i++) {
+                set_wheel_target(&slew[i], &wheel_dir[i], want_dir[i], want_speed[i]);
+            }
+            if (!pending) {
+                pending_stamp_ns = cmd.stamp_ns;
+            }
+            pending = true;
+        }
+
+        now = Timing_NowNs();
+        if (now < next_tick_ns) {
+            continue;
+        }
+        /* After an idle period, limit the first step to one tick */
+        dt_s = (now - last_tick_ns) / 1e9f;
+        if (dt_s > tick_s) {
+            dt_s = tick_s;
+        }
+        last_tick_ns = now;
+        next_tick_ns = now + tick_ns;
+
+        changed = Motor_Slew_Step(&slew[MOTOR_LEFT], dt_s);
+        changed |= Motor_Slew_Step(&slew[MOTOR_RIGHT], dt_s);
+        for (int i = 0; i < 2; i++) {
+            reverse_at_stop(&slew[i], &wheel_dir[i], want_dir[i], want_speed[i]);
+            atomic_store_explicit(&stat_target[i], slew[i].target, memory_order_relaxed);
+            atomic_store_explicit(&stat_actual[i], slew[i].actual, memory_order_relaxed);
+        }
+        if (!changed && !pending) {
+            continue;
+        }
+        apply_output(wheel_dir, 
+            (UWORD)(slew[MOTOR_LEFT].actual + 0.5f), 
+            (UWORD)(slew[MOTOR_RIGHT].actual + 0.5f));
+        atomic_fetch_add_explicit(&stat_updates, 1, memory_order_relaxed);
+        if (!pending) {
+            continue;
+        }
+        pending = false;
+
+        latency = Timing_NowNs() - pending_stamp_ns;
+        atomic_store_explicit(&stat_latency_last_ns, latency, memory_order_relaxed);
+        atomic_fetch_add_explicit(&stat_latency_total_ns, latency, memory_order_relaxed);
+        if (latency > atomic_load_explicit(&stat_latency_max_ns, memory_order_relaxed)) {
+            atomic_store_explicit(&stat_latency_max_ns, latency, memory_order_relaxed);
+        }
+        atomic_fetch_add_explicit(&stat_applied, 1, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+/**
+ * Start the actuator thread. Motor_Init must be called first.
+ * Returns 0 on success.
+ */
+int Actuator_Start(void)
+{
+    atomic_store(&queue_head, 0);
+    atomic_store(&queue_tail, 0);
+    atomic_store(&running, true);
+    if (sem_init(&wake, 0, 0) != 0) {
+        return -1;
+    }
+    if (pthread_create(&actuator_thread, NULL, actuator_routine, NULL) != 0) {
+        sem_destroy(&wake);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stop the actuator thread. Commands still in the queue are dropped.
+ */
+void Actuator_Stop(void)
+{
+    atomic_store(&running, false);
+    sem_post(&wake);
+    pthread_join(actuator_thread, NULL);
+    sem_destroy(&wake);
+}
+
+/**
+ * Publish a motor command and return without waiting for the bus.
+ * Must only be called from one thread (the control loop).
+ *
+ * If the actuator has fallen a full queue behind, the oldest 
+ * command is dropped to make room.
+ */
+void Actuator_Publish(DIR dir, UWORD speed_left, UWORD speed_right)
+{
+    unsigned head = atomic_load_explicit(&queue_head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&queue_tail, memory_order_acquire);
+    unsigned depth;
+
+    if (head - tail == ACTUATOR_QUEUE_LEN) {
+        if (atomic_compare_exchange_strong_explicit(&queue_tail, &tail, tail + 1,
+                memory_order_acq_rel, memory_order_acquire)) {
+            atomic_fetch_add_explicit(&stat_coalesced, 1, memory_order_relaxed);
+        }
+    }
+
+    MotorCommand* cmd = &queue[head & (ACTUATOR_QUEUE_LEN - 1)];
+    cmd->dir = dir;
+    cmd->speed_left = speed_left;
+    cmd->speed_right = speed_right;
+    cmd->stamp_ns = Timing_NowNs();
+    atomic_store_explicit(&queue_head, head + 1, memory_order_release);
+
+    depth = head + 1 - atomic_load_explicit(&queue_tail, memory_order_relaxed);
+    if (depth > atomic_load_explicit(&stat_max_depth, memory_order_relaxed)) {
+        atomic_store_explicit(&stat_max_depth, depth, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&stat_published, 1, memory_order_relaxed);
+    sem_post(&wake);
+}
+
+void Actuator_GetStats(ActuatorStats* stats)
+{
+    stats->depth = atomic_load(&queue_head) - atomic_load(&queue_tail);
+    stats->max_depth = atomic_load(&stat_max_depth);
+    stats->published = atomic_load(&stat_published);
+    stats->applied = atomic_load(&stat_applied);
+    stats->coalesced = atomic_load(&stat_coalesced);
+    stats->latency_last_ns = atomic_load(&stat_latency_last_ns);
+    stats->latency_max_ns = atomic_load(&stat_latency_max_ns);
+    stats->latency_total_ns = atomic_load(&stat_latency_total_ns);
+    stats->updates = atomic_load(&stat_updates);
+    stats->target_left = atomic_load(&stat_target[MOTOR_LEFT]);
+    stats->target_right = atomic_load(&stat_target[MOTOR_RIGHT]);
+    stats->actual_left = atomic_load(&stat_actual[MOTOR_LEFT]);
+    stats->actual_right = atomic_load(&stat_actual[MOTOR_RIGHT]);
+}
+
+void Actuator_PrintStats(void)
+{
+    ActuatorStats stats;
+    Actuator_GetStats(&stats);
+
+    printf("Actuator: published %u, applied %u, coalesced %u, depth %u (max %u)\n",
+        stats.published, stats.applied, stats.coalesced, stats.depth, stats.max_depth);
+    printf("Actuator: %u PWM updates, duty left %.0f/%.0f, right %.0f/%.0f (actual/target counts)\n",
+        stats.updates, stats.actual_left, stats.target_left, stats.actual_right, stats.target_right);
+    if (stats.applied > 0) {
+        printf("Actuator: latency last %.1f us, mean %.1f us, max %.1f us\n",
+            stats.latency_last_ns / 1000.0,
+            stats.latency_total_ns / 1000.0 / stats.applied,
+            stats.latency_max_ns / 1000.0);
+    }
+}
@@ -0,0 +1,73 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         MotorActuator.h
+*
+* Description:
+*   Declarations for the actuator thread which owns the motor driver. 
+*   The control loop publishes motor commands without blocking and the
+*   actuator thread writes the newest one to the bus.
+******************************************************************************/
+
+#ifndef _MOTOR_ACTUATOR_H
+#define _MOTOR_ACTUATOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "MotorDriver.h"
+
+
+/* Must be a power of two */
+#define ACTUATOR_QUEUE_LEN 16
+
+/* Rate at which duty cycle updates are written to the motors */
+#define ACTUATOR_TICK_HZ 100
+
+/* Duty cycle slew limits in counts per second (0 = unlimited).
+ * Braking is faster than speeding up, full speed to a stop in 0.1 s.
+ * Reversals ramp down at the braking rate, through zero. */
+#define ACTUATOR_ACCEL_RATE MOTOR_DUTY_PERCENT(400.0f)
+#define ACTUATOR_DECEL_RATE MOTOR_DUTY_PERCENT(1000.0f)
+
+typedef struct {
+    DIR dir;                /* FORWARD, BACKWARD, LEFT or RIGHT relative to the car */
+    UWORD speed_left;       /* Duty cycle of the left motor (0 ~ MOTOR_DUTY_MAX) */
+    UWORD speed_right;      /* Duty cycle of the right motor (0 ~ MOTOR_DUTY_MAX) */
+    uint64_t stamp_ns;      /* Monotonic time the command was published */
+} MotorCommand;
+
+typedef struct {
+    uint32_t depth;             /* Commands waiting to be applied */
+    uint32_t max_depth;         /* Highest depth seen */
+    uint32_t published;         /* Commands published by the control loop */
+    uint32_t applied;           /* Commands written to the bus */
+    uint32_t coalesced;         /* Commands superseded before reaching the bus */
+    uint64_t latency_last_ns;   /* Publish to bus latency of the last command */
+    uint64_t latency_max_ns;
+    uint64_t latency_total_ns;  /* Sum over all applied commands, for the mean */
+    uint32_t updates;           /* Frames written to the motors */
+    float target_left;          /* Duty cycle requested by the last command */
+    float target_right;
+    float actual_left;          /* Duty cycle currently applied */
+    float actual_right;
+} ActuatorStats;
+
+
+int Actuator_Start(void);
+void Actuator_Stop(void);
+
+void Actuator_Publish(DIR dir, UWORD speed_left, UWORD speed_right);
+
+void Actuator_GetStats(ActuatorStats* stats);
+void Actuator_PrintStats(void);
+
+
+#endif  /* _MOTOR_ACTUATOR_H */
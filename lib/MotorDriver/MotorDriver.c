@@ -37,107 +37,133 @@ void Motor_Set_Direction(UBYTE motor, DIR direction, UWORD speed)
 
 
 /**
- * Accelerate from the current power level to desired.
- * Duty cycle is updated in increments of `rate`.
- * Maximum desired power level is 100.
- * 
- * Returns the updated power level of the given motor.
+ * Set up a slew-rate limiter for one motor.
+ *
+ * @param accel: maximum increase of the duty cycle, in counts per second.
+ * @param decel: maximum decrease of the duty cycle, in counts per second.
+ *               A rate of 0 means the change is applied at once.
+ * @param initial: duty cycle the motor is running at now.
  */
-UWORD Motor_Increase_Speed(UBYTE motor, UWORD current, UWORD desired, int rate)
+void Motor_Slew_Init(MotorSlew* slew, float accel, float decel, float initial)
 {
-    if (desired > 100) { desired = 100; }
-
-    while (current < desired)
-    {
-        current += rate;
-
-        /* Maximum allowed duty cycle is 100% */
-        if (current > 100) { 
-            current = 100; 
-        }
-        /* Avoid overshooting the target value */
-        if (current > desired) {
-            current = desired;
-        }
-        /* Update the duty cycle for the given motor */
-        if (motor == MOTORA) {
-            PCA9685_SetPwmDutyCycle(PWMA, current);
-        } 
-        else if (motor == MOTORB) {
-            PCA9685_SetPwmDutyCycle(PWMB, current);
-        }
-    }
-    return current;
+    slew->accel = accel;
+    slew->decel = decel;
+    slew->target = initial;
+    slew->actual = initial;
 }
 
-
 /**
- * Decelerate from the current power level to desired.
- * Duty cycle is updated in increments of `rate`.
- * Minimum desired power level is 0.
- * 
- * Returns the updated power level of the given motor.
+ * Set the duty cycle the limiter should move towards (0 ~ MOTOR_DUTY_MAX).
  */
-UWORD Motor_Decrease_Speed(UBYTE motor, UWORD current, UWORD desired, int rate)
+void Motor_Slew_Set_Target(MotorSlew* slew, float target)
 {
-    if (desired < 0) { desired = 0; }
+    if (target < 0) { target = 0; }
+    if (target > MOTOR_DUTY_MAX) { target = MOTOR_DUTY_MAX; }
+    slew->target = target;
+}
 
-    while (current > desired)
-    {
-        current -= rate;
+/**
+ * Advance the limiter by one control tick.
+ * The actual duty cycle moves towards the target by at most
+ * rate * dt_s, so the motor gets a real acceleration limit no 
+ * matter how often the target changes.
+ *
+ * Returns true if the actual duty cycle changed.
+ */
+bool Motor_Slew_Step(MotorSlew* slew, float dt_s)
+{
+    float before = slew->actual;
+    float step;
 
-        /* Prevent setting a negative duty cycle */
-        if (current < 0) { 
-            current = 0; 
-        }
-        /* Prevent overshooting the desired value */
-        if (current < desired) { 
-            current = desired; 
+    if (slew->target > slew->actual) {
+        step = slew->accel * dt_s;
+        if (slew->accel <= 0 || slew->actual + step > slew->target) {
+            slew->actual = slew->target;
+        } else {
+            slew->actual += step;
         }
-        /* Update the duty cycle for the given motor */
-        if (motor == MOTORA) {
-            PCA9685_SetPwmDutyCycle(PWMA, current);
-        } 
-        else if (motor == MOTORB) {
-            PCA9685_SetPwmDutyCycle(PWMB, current);
+    }
+    else if (slew->target < slew->actual) {
+        step = slew->decel * dt_s;
+        if (slew->decel <= 0 || slew->actual - step < slew->target) {
+            slew->actual = slew->target;
+        } else {
+            slew->actual -= step;
         }
     }
-    return current;
+    return slew->actual != before;
 }
 
+/**
+ * Check whether the limiter still has ground to cover.
+ */
+bool Motor_Slew_Busy(const MotorSlew* slew)
+{
+    return slew->actual != slew->target;
+}
 
-void Motor_Run(UBYTE motor, DIR dir, UWORD speed)
+
+/**
+ * Stage the speed and direction channels of one motor
+ * in the current PCA9685 frame.
+ * Speed is a 12-bit duty cycle (0 ~ MOTOR_DUTY_MAX).
+ */
+static void Motor_Stage(UBYTE motor, DIR dir, UWORD speed)
 {
-    if(speed > 100)
-        speed = 100;
+    if(speed > MOTOR_DUTY_MAX)
+        speed = MOTOR_DUTY_MAX;
 
     if(motor == MOTORA) {
         DEBUG("Motor A Speed = %d\r\n", speed);
-        PCA9685_SetPwmDutyCycle(PWMA, speed);
+        PCA9685_StageDuty(PWMA, speed);
         if(dir == FORWARD) {
             DEBUG("forward...\r\n");
-            PCA9685_SetLevel(AIN1, 0);
-            PCA9685_SetLevel(AIN2, 1);
+            PCA9685_StageLevel(AIN1, 0);
+            PCA9685_StageLevel(AIN2, 1);
         } else {
             DEBUG("backward...\r\n");
-            PCA9685_SetLevel(AIN1, 1);
-            PCA9685_SetLevel(AIN2, 0);
+            PCA9685_StageLevel(AIN1, 1);
+            PCA9685_StageLevel(AIN2, 0);
         }
     } else {
         DEBUG("Motor B Speed = %d\r\n", speed);
-        PCA9685_SetPwmDutyCycle(PWMB, speed);
+        PCA9685_StageDuty(PWMB, speed);
         if(dir == FORWARD) {
             DEBUG("forward...\r\n");
-            PCA9685_SetLevel(BIN1, 0);
-            PCA9685_SetLevel(BIN2, 1);
+            PCA9685_StageLevel(BIN1, 0);
+            PCA9685_StageLevel(BIN2, 1);
         } else {
             DEBUG("backward...\r\n");
-            PCA9685_SetLevel(BIN1, 1);
-            PCA9685_SetLevel(BIN2, 0);
+            PCA9685_StageLevel(BIN1, 1);
+            PCA9685_StageLevel(BIN2, 0);
         }
     }
 }
 
+void Motor_Run(UBYTE motor, DIR dir, UWORD speed)
+{
+    PCA9685_BeginFrame();
+    Motor_Stage(motor, dir, speed);
+    PCA9685_CommitFrame();
+}
+
+/**
+ * Update both motors at once.
+ * The channels of both motors are adjacent on the PCA9685,
+ * so this costs one I2C transaction instead of one per register.
+ *
+ * Example:
+ * @code
+ * Motor_Run_Both(MOTOR_LEFT_FORWARD, MOTOR_DUTY_MAX, MOTOR_RIGHT_FORWARD, MOTOR_DUTY_MAX);
+ */
+void Motor_Run_Both(DIR dir_a, UWORD speed_a, DIR dir_b, UWORD speed_b)
+{
+    PCA9685_BeginFrame();
+    Motor_Stage(MOTORA, dir_a, speed_a);
+    Motor_Stage(MOTORB, dir_b, speed_b);
+    PCA9685_CommitFrame();
+}
+
 /**
  * Motor stop rotation.
  *
@@ -150,8 +176,8 @@ void Motor_Run(UBYTE motor, DIR dir, UWORD speed)
 void Motor_Stop(UBYTE motor)
 {
     if(motor == MOTORA) {
-        PCA9685_SetPwmDutyCycle(PWMA, 0);
+        PCA9685_SetDuty(PWMA, 0);
     } else {
-        PCA9685_SetPwmDutyCycle(PWMB, 0);
+        PCA9685_SetDuty(PWMB, 0);
     }
 }
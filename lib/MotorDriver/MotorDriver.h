@@ -16,6 +16,7 @@
 #ifndef __TB6612FNG_
 #define __TB6612FNG_
 
+#include <stdbool.h>
 #include "DEV_Config.h"
 #include "PCA9685.h"
 
@@ -27,6 +28,10 @@
 #define BIN1        PCA_CHANNEL_3
 #define BIN2        PCA_CHANNEL_4
 
+/* Motor speeds are 12-bit PCA9685 duty cycles */
+#define MOTOR_DUTY_MAX          PCA9685_DUTY_MAX
+#define MOTOR_DUTY_PERCENT(p)   ((p) * MOTOR_DUTY_MAX / 100)
+
 #define MOTORA       0
 #define MOTORB       1
 
@@ -48,15 +53,28 @@ typedef enum {
     RIGHT
 } DIR;
 
+/**
+ * Slew-rate limiter for the duty cycle of one motor
+ */
+typedef struct {
+    float target;   /* Requested duty cycle (0 ~ MOTOR_DUTY_MAX) */
+    float actual;   /* Duty cycle currently applied */
+    float accel;    /* Maximum increase, counts per second (0 = unlimited) */
+    float decel;    /* Maximum decrease, counts per second (0 = unlimited) */
+} MotorSlew;
+
 void Motor_Init(void);
 void Motor_Run(UBYTE motor, DIR dir, UWORD speed);
+void Motor_Run_Both(DIR dir_a, UWORD speed_a, DIR dir_b, UWORD speed_b);
 
 void Motor_Stop(UBYTE motor);
 
 void Motor_Change_Direc(DIR dir);
 void Motor_Set_Direction(UBYTE motor, DIR direction, UWORD speed);
 
-UWORD Motor_Increase_Speed(UBYTE motor,UWORD current,UWORD accel,int rate);
-UWORD Motor_Decrease_Speed(UBYTE motor,UWORD current,UWORD slow,int rate);
+void Motor_Slew_Init(MotorSlew* slew, float accel, float decel, float initial);
+void Motor_Slew_Set_Target(MotorSlew* slew, float target);
+bool Motor_Slew_Step(MotorSlew* slew, float dt_s);
+bool Motor_Slew_Busy(const MotorSlew* slew);
 
 #endif
@@ -16,6 +16,78 @@
 #include "Debug.h"  //DEBUG()
 #include <math.h>   //floor()
 #include <stdio.h>
+#include <string.h> //memset()
+
+/**
+ * Frame staging area: LEDn_ON_L..LEDn_OFF_H for every channel, and a
+ * bitmask of the channels that have been staged since BeginFrame.
+ */
+static UBYTE frame_regs[PCA_CHANNEL_COUNT * 4];
+static UWORD frame_staged;
+
+/**
+ * Shadow copy of the chip registers, indexed by register address.
+ * A register is only trusted once it has been written or read through
+ * this driver, and writes that would not change it are dropped.
+ */
+static UBYTE shadow[256];
+static UBYTE shadow_valid[256];
+static PCA9685_CACHE_STATS cache_stats;
+
+/**
+ * Check whether the chip already holds value in reg.
+ * MODE1 writes with RESTART set are never skipped since the bit
+ * self-clears once the oscillator has restarted.
+ */
+static UBYTE PCA9685_IsCached(UBYTE reg, UBYTE value)
+{
+    if (reg == MODE1 && (value & MODE1_RESTART))
+        return 0;
+    return shadow_valid[reg] && shadow[reg] == value;
+}
+
+/**
+ * Record the value the chip now holds in reg.
+ */
+static void PCA9685_Remember(UBYTE reg, UBYTE value)
+{
+    if (reg == MODE1)
+        value &= ~MODE1_RESTART;
+    shadow[reg] = value;
+    shadow_valid[reg] = 1;
+}
+
+/**
+ * Check whether all four registers of a channel already hold regs.
+ */
+static UBYTE PCA9685_ChannelCached(UBYTE channel, const UBYTE *regs)
+{
+    UBYTE i;
+    for (i = 0; i < 4; i++) {
+        if (!PCA9685_IsCached(LED0_ON_L + 4*channel + i, regs[i]))
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * Write count consecutive channels starting at first in one burst
+ * and update the shadow copy. If the write fails the chip state is
+ * unknown, so the shadow of those channels is dropped instead.
+ */
+static void PCA9685_WriteChannels(UBYTE first, UBYTE count, UBYTE *regs)
+{
+    UBYTE i;
+    int ret = I2C_Write_nByte(LED0_ON_L + 4*first, regs, 4*count);
+
+    for (i = 0; i < 4*count; i++) {
+        if (ret == 0)
+            PCA9685_Remember(LED0_ON_L + 4*first + i, regs[i]);
+        else
+            shadow_valid[LED0_ON_L + 4*first + i] = 0;
+    }
+    cache_stats.misses += 4*count;
+}
 
 /**
  * Write bytes in PCA9685
@@ -28,11 +100,56 @@
  */
 static void PCA9685_WriteByte(UBYTE reg, UBYTE value)
 {
-    I2C_Write_Byte(reg, value);
+    if (PCA9685_IsCached(reg, value)) {
+        cache_stats.hits++;
+        return;
+    }
+    if (I2C_Write_Byte(reg, value) == 0)
+        PCA9685_Remember(reg, value);
+    else
+        shadow_valid[reg] = 0;
+    cache_stats.misses++;
+}
+
+/**
+ * Write several unrelated registers in one combined transfer.
+ * Registers are written in order, so the same register may appear
+ * more than once (e.g. MODE1 before and after PRESCALE).
+ *
+ * @param regs: register addresses.
+ * @param values: values to write.
+ * @param count: number of registers.
+ */
+static void PCA9685_WriteBytes(const UBYTE *regs, const UBYTE *values, UBYTE count)
+{
+    UBYTE send_regs[count];
+    UBYTE send_values[count];
+    UBYTE i, n = 0;
+
+    for (i = 0; i < count; i++) {
+        if (PCA9685_IsCached(regs[i], values[i])) {
+            cache_stats.hits++;
+            continue;
+        }
+        send_regs[n] = regs[i];
+        send_values[n] = values[i];
+        PCA9685_Remember(regs[i], values[i]);
+        n++;
+    }
+    if (n == 0)
+        return;
+
+    cache_stats.misses += n;
+    if (I2C_Write_Bytes(send_regs, send_values, n) != 0) {
+        for (i = 0; i < n; i++) {
+            shadow_valid[send_regs[i]] = 0;
+        }
+    }
 }
 
 /**
  * read byte in PCA9685.
+ * Registers held in the shadow copy are answered without a bus access.
  *
  * @param reg: register.
  *
@@ -41,7 +158,16 @@ static void PCA9685_WriteByte(UBYTE reg, UBYTE value)
  */
 static UBYTE PCA9685_ReadByte(UBYTE reg)
 {
-    return I2C_Read_Byte(reg);
+    if (shadow_valid[reg]) {
+        cache_stats.hits++;
+        return shadow[reg];
+    }
+    int value = I2C_Read_Byte(reg);
+    cache_stats.misses++;
+    if (value < 0)
+        return 0;
+    PCA9685_Remember(reg, value);
+    return value;
 }
 
 /**
@@ -57,10 +183,42 @@ static UBYTE PCA9685_ReadByte(UBYTE reg)
  */
 static void PCA9685_SetPWM(UBYTE channel, UWORD on, UWORD off)
 {
-    PCA9685_WriteByte(LED0_ON_L + 4*channel, on & 0xFF);
-    PCA9685_WriteByte(LED0_ON_H + 4*channel, on >> 8);
-    PCA9685_WriteByte(LED0_OFF_L + 4*channel, off & 0xFF);
-    PCA9685_WriteByte(LED0_OFF_H + 4*channel, off >> 8);
+    UBYTE regs[4] = {on & 0xFF, on >> 8, off & 0xFF, off >> 8};
+
+    if (PCA9685_ChannelCached(channel, regs)) {
+        cache_stats.hits += 4;
+        return;
+    }
+    PCA9685_WriteChannels(channel, 1, regs);
+}
+
+/**
+ * Convert a 12-bit duty cycle to the ON and OFF counts of a channel.
+ * 0 and PCA9685_DUTY_MAX use the full-off and full-on bits, so the
+ * output is really off or really on instead of one count short.
+ */
+static void PCA9685_DutyToPWM(UWORD duty, UWORD *on, UWORD *off)
+{
+    if (duty == 0) {
+        *on = 0;
+        *off = PCA9685_FULL;
+    } else if (duty >= PCA9685_DUTY_MAX) {
+        *on = PCA9685_FULL;
+        *off = 0;
+    } else {
+        *on = 0;
+        *off = duty;
+    }
+}
+
+/**
+ * Convert a duty cycle in percent to a 12-bit duty cycle.
+ */
+static UWORD PCA9685_PercentToDuty(UWORD pulse)
+{
+    if (pulse > 100)
+        pulse = 100;
+    return (UDOUBLE)pulse * PCA9685_DUTY_MAX / 100;
 }
 
 /**
@@ -76,7 +234,8 @@ static void PCA9685_SetPWM(UBYTE channel, UWORD on, UWORD off)
 void PCA9685_Init(char addr)
 {
     DEV_I2C_Init(addr);
-    I2C_Write_Byte(MODE1, 0x00);
+    PCA9685_InvalidateCache();
+    PCA9685_WriteByte(MODE1, MODE1_AI);
 }
 
 /**
@@ -105,14 +264,22 @@ void PCA9685_SetPWMFreq(UWORD freq)
     UBYTE prescale = floor(prescaleval + 0.5);
     DEBUG("prescaleval = %lf\r\n", prescaleval);
 
-    UBYTE oldmode = PCA9685_ReadByte(MODE1);
-    UBYTE newmode = (oldmode & 0x7F) | 0x10; // sleep
+    /* Changing the prescaler means putting the oscillator to sleep,
+     * so skip the whole sequence if it is already set */
+    if (PCA9685_IsCached(PRESCALE, prescale)) {
+        cache_stats.hits++;
+        return;
+    }
 
-    PCA9685_WriteByte(MODE1, newmode); // go to sleep
-    PCA9685_WriteByte(PRESCALE, prescale); // set the prescaler
-    PCA9685_WriteByte(MODE1, oldmode);
+    UBYTE oldmode = PCA9685_ReadByte(MODE1) | MODE1_AI;
+    UBYTE newmode = (oldmode & ~MODE1_RESTART) | MODE1_SLEEP; // sleep
+
+    /* go to sleep, set the prescaler and wake up in one transfer */
+    UBYTE regs[3] = {MODE1, PRESCALE, MODE1};
+    UBYTE values[3] = {newmode, prescale, oldmode};
+    PCA9685_WriteBytes(regs, values, 3);
     DEV_Delay_ms(5);
-    PCA9685_WriteByte(MODE1, oldmode | 0x80);  //  This sets the MODE1 register to turn on auto increment.
+    PCA9685_WriteByte(MODE1, oldmode | MODE1_RESTART);  // restart the PWM outputs, auto increment stays on
 }
 
 /**
@@ -126,7 +293,23 @@ void PCA9685_SetPWMFreq(UWORD freq)
  */
 void PCA9685_SetPwmDutyCycle(UBYTE channel, UWORD pulse)
 {
-    PCA9685_SetPWM(channel, 0, pulse * (4096 / 100) - 1);
+    PCA9685_SetDuty(channel, PCA9685_PercentToDuty(pulse));
+}
+
+/**
+ * Set channel output the PWM duty cycle at full resolution.
+ * 
+ * @param channel: 16 output channels.  //(0 ~ 15)
+ * @param duty: duty cycle.  //(0 ~ 4095  == 0% ~ 100%)
+ *
+ * Example:
+ * PCA9685_SetDuty(1, 2048);
+ */
+void PCA9685_SetDuty(UBYTE channel, UWORD duty)
+{
+    UWORD on, off;
+    PCA9685_DutyToPWM(duty, &on, &off);
+    PCA9685_SetPWM(channel, on, off);
 }
 
 /**
@@ -140,8 +323,133 @@ void PCA9685_SetPwmDutyCycle(UBYTE channel, UWORD pulse)
  */
 void PCA9685_SetLevel(UBYTE channel, UWORD value)
 {
-    if (value == 1)
-        PCA9685_SetPWM(channel, 0, 4095);
-    else
-        PCA9685_SetPWM(channel, 0, 0);
+    PCA9685_SetDuty(channel, value == 1 ? PCA9685_DUTY_MAX : 0);
+}
+
+/**
+ * Start a new frame of channel updates.
+ * Channels staged before the next commit are written together.
+ *
+ * Example:
+ * PCA9685_BeginFrame();
+ * PCA9685_StageDutyCycle(0, 50);
+ * PCA9685_StageLevel(1, 1);
+ * PCA9685_CommitFrame();
+ */
+void PCA9685_BeginFrame(void)
+{
+    frame_staged = 0;
+}
+
+/**
+ * Stage the PWM output of a channel in the current frame.
+ *
+ * @param channel: 16 output channels.  //(0 ~ 15)
+ * @param on: ON count.  //(0 ~ 4095)
+ * @param off: OFF count.  //(0 ~ 4095)
+ */
+void PCA9685_StagePWM(UBYTE channel, UWORD on, UWORD off)
+{
+    UBYTE *regs = &frame_regs[4*channel];
+
+    regs[0] = on & 0xFF;
+    regs[1] = on >> 8;
+    regs[2] = off & 0xFF;
+    regs[3] = off >> 8;
+    frame_staged |= 1 << channel;
+}
+
+/**
+ * Stage the duty cycle of a channel in the current frame.
+ *
+ * @param channel: 16 output channels.  //(0 ~ 15)
+ * @param pulse: duty cycle.  //(0 ~ 100  == 0% ~ 100%)
+ */
+void PCA9685_StageDutyCycle(UBYTE channel, UWORD pulse)
+{
+    PCA9685_StageDuty(channel, PCA9685_PercentToDuty(pulse));
+}
+
+/**
+ * Stage the duty cycle of a channel at full resolution.
+ *
+ * @param channel: 16 output channels.  //(0 ~ 15)
+ * @param duty: duty cycle.  //(0 ~ 4095  == 0% ~ 100%)
+ */
+void PCA9685_StageDuty(UBYTE channel, UWORD duty)
+{
+    UWORD on, off;
+    PCA9685_DutyToPWM(duty, &on, &off);
+    PCA9685_StagePWM(channel, on, off);
+}
+
+/**
+ * Stage the output level of a channel in the current frame.
+ *
+ * @param channel: 16 output channels.  //(0 ~ 15)
+ * @param value: output level, 0 low level, 1 high level.  //0 or 1
+ */
+void PCA9685_StageLevel(UBYTE channel, UWORD value)
+{
+    PCA9685_StageDuty(channel, value == 1 ? PCA9685_DUTY_MAX : 0);
+}
+
+/**
+ * Write the staged channels to the chip.
+ * Each run of consecutive channels goes out as one auto-increment
+ * burst, so the six motor channels (0 ~ 5) cost a single transaction.
+ */
+void PCA9685_CommitFrame(void)
+{
+    UWORD dirty = 0;
+    UBYTE channel, start, end;
+
+    /* Drop channels whose registers already hold the staged values */
+    for (channel = 0; channel < PCA_CHANNEL_COUNT; channel++) {
+        if (!(frame_staged & (1 << channel)))
+            continue;
+        if (PCA9685_ChannelCached(channel, &frame_regs[4*channel]))
+            cache_stats.hits += 4;
+        else
+            dirty |= 1 << channel;
+    }
+
+    for (start = 0; start < PCA_CHANNEL_COUNT; start = end + 1) {
+        if (!(dirty & (1 << start))) {
+            end = start;
+            continue;
+        }
+        for (end = start; end + 1 < PCA_CHANNEL_COUNT && (dirty & (1 << (end + 1))); end++);
+
+        PCA9685_WriteChannels(start, end - start + 1, &frame_regs[4*start]);
+    }
+    frame_staged = 0;
+}
+
+/**
+ * Get the shadow register cache counters.
+ * A hit is a register write (or read) that was answered from the
+ * shadow copy, a miss is a register that went out on the bus.
+ *
+ * @param stats: receives a copy of the counters.
+ */
+void PCA9685_GetCacheStats(PCA9685_CACHE_STATS *stats)
+{
+    *stats = cache_stats;
+}
+
+void PCA9685_ResetCacheStats(void)
+{
+    cache_stats.hits = 0;
+    cache_stats.misses = 0;
+}
+
+/**
+ * Forget the shadow copy, so the next write to every register goes
+ * out on the bus. Use this if the chip may have been reset or written
+ * by something other than this driver.
+ */
+void PCA9685_InvalidateCache(void)
+{
+    memset(shadow_valid, 0, sizeof(shadow_valid));
 }
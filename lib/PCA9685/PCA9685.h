@@ -31,6 +31,11 @@
 #define ALLLED_OFF_L        0xFC
 #define ALLLED_OFF_H        0xFD
 
+//MODE1 bits
+#define MODE1_RESTART       0x80
+#define MODE1_AI            0x20
+#define MODE1_SLEEP         0x10
+
 #define PCA_CHANNEL_0       0
 #define PCA_CHANNEL_1       1
 #define PCA_CHANNEL_2       2
@@ -47,10 +52,35 @@
 #define PCA_CHANNEL_13      13
 #define PCA_CHANNEL_14      14
 #define PCA_CHANNEL_15      15
+#define PCA_CHANNEL_COUNT   16
+
+//12-bit duty cycle
+#define PCA9685_DUTY_MAX    4095    //100%
+#define PCA9685_FULL        0x1000  //full-on / full-off bit of LEDn_ON / LEDn_OFF
+
+/**
+ * Shadow register cache counters, in registers
+**/
+typedef struct {
+    UDOUBLE hits;       //register accesses answered from the shadow copy
+    UDOUBLE misses;     //register accesses that went out on the bus
+} PCA9685_CACHE_STATS;
 
 void PCA9685_Init(char addr);
 void PCA9685_SetPWMFreq(UWORD freq);
 void PCA9685_SetPwmDutyCycle(UBYTE channel, UWORD pulse);
+void PCA9685_SetDuty(UBYTE channel, UWORD duty);
 void PCA9685_SetLevel(UBYTE channel, UWORD value);
 
+void PCA9685_BeginFrame(void);
+void PCA9685_StagePWM(UBYTE channel, UWORD on, UWORD off);
+void PCA9685_StageDutyCycle(UBYTE channel, UWORD pulse);
+void PCA9685_StageDuty(UBYTE channel, UWORD duty);
+void PCA9685_StageLevel(UBYTE channel, UWORD value);
+void PCA9685_CommitFrame(void);
+
+void PCA9685_GetCacheStats(PCA9685_CACHE_STATS *stats);
+void PCA9685_ResetCacheStats(void);
+void PCA9685_InvalidateCache(void);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,165 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         Timing.c
+*
+* Description:
+*   Timing helpers shared by every driver. All timestamps are taken on
+*   CLOCK_MONOTONIC, which does not jump when the wall clock is set, and
+*   intervals are always computed from whole timestamps rather than from
+*   the nanosecond field alone. The clock can be replaced to exercise 
+*   code against chosen times, such as a clock about to roll over.
+******************************************************************************/
+
+
+#include <errno.h>
+
+#include "Timing.h"
+
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return Timing_TimespecNs(&ts);
+}
+
+static TimingClock now_clock = monotonic_ns;
+
+
+/**
+ * Current time in nanoseconds on the monotonic clock (or the clock
+ * given to Timing_SetClock).
+ */
+uint64_t Timing_NowNs(void)
+{
+    return now_clock();
+}
+
+/**
+ * Replace the clock behind Timing_NowNs. NULL restores the monotonic
+ * clock. Must be called before any thread which reads the time starts.
+ * Sleeping always uses the real monotonic clock.
+ */
+void Timing_SetClock(TimingClock clock)
+{
+    now_clock = clock != NULL ? clock : monotonic_ns;
+}
+
+/**
+ * CPU time used so far by the calling thread.
+ */
+uint64_t Timing_ThreadCpuNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return Timing_TimespecNs(&ts);
+}
+
+uint64_t Timing_TimespecNs(const struct timespec* ts)
+{
+    return (uint64_t)ts->tv_sec * TIMING_NS_PER_S + (uint64_t)ts->tv_nsec;
+}
+
+void Timing_NsTimespec(uint64_t ns, struct timespec* ts)
+{
+    ts->tv_sec = (time_t)(ns / TIMING_NS_PER_S);
+    ts->tv_nsec = (long)(ns % TIMING_NS_PER_S);
+}
+
+/**
+ * Microseconds from earlier to later on pigpio's tick, which wraps
+ * every 2^32 us (about 72 minutes). Correct across a wrap as long as 
+ * the two ticks are less than 2^31 us apart; negative if later is 
+ * actually the earlier of the two.
+ */
+int32_t Timing_TickDiff(uint32_t later, uint32_t earlier)
+{
+    return (int32_t)(later - earlier);
+}
+
+/**
+ * Whether tick a comes before tick b, allowing for the tick wrapping.
+ */
+bool Timing_TickBefore(uint32_t a, uint32_t b)
+{
+    return Timing_TickDiff(b, a) > 0;
+}
+
+/**
+ * Convert a pigpio tick to a monotonic timestamp, given the tick and 
+ * the monotonic time read at (about) the same moment.
+ */
+uint64_t Timing_TickToNs(uint32_t tick, uint32_t now_tick, uint64_t now_ns)
+{
+    return now_ns - (int64_t)Timing_TickDiff(now_tick, tick) * (int64_t)TIMING_NS_PER_US;
+}
+
+/**
+ * Monotonic deadline timeout_ns from now.
+ */
+uint64_t Timing_Deadline(uint64_t timeout_ns)
+{
+    return Timing_NowNs() + timeout_ns;
+}
+
+bool Timing_Expired(uint64_t deadline_ns)
+{
+    return Timing_NowNs() >= deadline_ns;
+}
+
+/**
+ * Sleep until a monotonic deadline, resuming after signals.
+ */
+void Timing_SleepUntil(uint64_t deadline_ns)
+{
+    struct timespec wake;
+
+    Timing_NsTimespec(deadline_ns, &wake);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+        /* Interrupted by a signal, sleep the rest of the time */
+    }
+}
+
+/**
+ * Advance a fixed-rate schedule by one period. If the next wakeup has
+ * already passed, whole periods are skipped so the schedule keeps its
+ * phase instead of trying to catch up. Returns the number of periods
+ * skipped.
+ */
+uint32_t Timing_NextPeriod(uint64_t* next_ns, uint64_t period_ns)
+{
+    uint64_t now = Timing_NowNs();
+    uint64_t missed;
+
+    *next_ns += period_ns;
+    if (*next_ns > now) {
+        return 0;
+    }
+    missed = (now - *next_ns) / period_ns + 1;
+    *next_ns += missed * period_ns;
+    return (uint32_t)missed;
+}
+
+/**
+ * Convert a monotonic deadline into the CLOCK_REALTIME deadline taken
+ * by sem_timedwait() and pthread_cond_timedwait(). Only the time left
+ * is carried over, so a step of the wall clock while waiting can still
+ * shorten or lengthen the wait, but cannot corrupt a measurement.
+ */
+void Timing_RealtimeDeadline(uint64_t deadline_ns, struct timespec* ts)
+{
+    uint64_t now = Timing_NowNs();
+    uint64_t remaining = deadline_ns > now ? deadline_ns - now : 0;
+
+    clock_gettime(CLOCK_REALTIME, ts);
+    Timing_NsTimespec(Timing_TimespecNs(ts) + remaining, ts);
+}
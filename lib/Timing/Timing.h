@@ -0,0 +1,52 @@
+ /******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car 
+*
+* File:         Timing.h
+*
+* Description:
+*   Declarations for the timing helpers shared by every driver: monotonic
+*   timestamps, wrap-safe arithmetic on pigpio's 32-bit microsecond tick,
+*   and deadlines.
+******************************************************************************/
+
+#ifndef _TIMING_H
+#define _TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#define TIMING_NS_PER_US    1000ull
+#define TIMING_NS_PER_MS    1000000ull
+#define TIMING_NS_PER_S     1000000000ull
+
+/* Source of monotonic nanosecond timestamps */
+typedef uint64_t (*TimingClock)(void);
+
+uint64_t Timing_NowNs(void);
+void Timing_SetClock(TimingClock clock);
+uint64_t Timing_ThreadCpuNs(void);
+
+uint64_t Timing_TimespecNs(const struct timespec* ts);
+void Timing_NsTimespec(uint64_t ns, struct timespec* ts);
+
+int32_t Timing_TickDiff(uint32_t later, uint32_t earlier);
+bool Timing_TickBefore(uint32_t a, uint32_t b);
+uint64_t Timing_TickToNs(uint32_t tick, uint32_t now_tick, uint64_t now_ns);
+
+uint64_t Timing_Deadline(uint64_t timeout_ns);
+bool Timing_Expired(uint64_t deadline_ns);
+void Timing_SleepUntil(uint64_t deadline_ns);
+uint32_t Timing_NextPeriod(uint64_t* next_ns, uint64_t period_ns);
+void Timing_RealtimeDeadline(uint64_t deadline_ns, struct timespec* ts);
+
+
+#endif  /* _TIMING_H */
@@ -27,12 +27,16 @@
 #include <fcntl.h>      /* For O_* constants */
 #include <string.h>     /* memcpy() */
 #include "MotorDriver.h"
+#include "MotorActuator.h"
+#include "7366rDriver.h"
+#include "WheelSpeed.h"
 
 #include <pigpio.h>
 
 #include "sensor.h"
 #include "sonar.h"
 #include "movement.h"
+#include "Timing.h"
 
 #include <errno.h>
 
@@ -50,30 +54,81 @@
 #define PIN_SONAR_LEFT_ECHO       20
 #define PIN_SONAR_LEFT_TRIG       21
 
+/* Sonar slots in the shared sensor state */
+#define SONAR_FRONT         0
+#define SONAR_LEFT          1
+
+/* Furthest range each sonar listens to. The front sonar must see far
+ * enough ahead to brake from full speed; the left one only needs to
+ * cover the distance to an obstacle being passed. */
+#define SONAR_FRONT_RANGE_CM    100.0f
+#define SONAR_LEFT_RANGE_CM     50.0f
+
 #define NUM_LINE_SENSORS    5
 #define NUM_MOTORS          2
 
+/* Hold the wheels at their target speeds with the closed-loop
+ * speed controller, rather than driving fixed duty cycles */
+#define CLOSED_LOOP_SPEED   false
+
+/* Steer in proportion to the estimated line position, rather than
+ * stepping the wheel speeds according to the line policy table */
+#define PROPORTIONAL_STEERING false
+
+/* Wake the main loop on line sensor transitions reported by pigpio
+ * alerts (1), or poll the sensors from a sampler thread (0) */
+#define LINE_SENSOR_EDGES   1
+
+/* Filter the line sensors with pigpio's glitch filter, and with a
+ * majority vote on either path, which lets the steering react after 
+ * fewer readings */
+#define LINE_SENSOR_FILTERED 1
+
+/* Longest time between passes of the main loop */
+#define CONTROL_PERIOD_US   1000
+
 
 static volatile bool terminate = false;
+static volatile bool reload_policy = false;
 
 void handle_interrupt(int signal)
 {
     terminate = true;
 }
 
+void handle_hangup(int signal)
+{
+    reload_policy = true;
+}
+
 void init_program_state(ProgramState* state)
 {
     state->last_dir = STRAIGHT;
     state->last_req = STRAIGHT;
-    state->speed_left = 100;
-    state->speed_right = 100;
+    state->speed_left = MOTOR_DUTY_MAX;
+    state->speed_right = MOTOR_DUTY_MAX;
     state->inner_confidence = 0;
     state->outer_confidence = 0;
+    state->confidence_threshold = LINE_SENSOR_FILTERED
+        ? FILTERED_CONFIDENCE_THRESHOLD : CONFIDENCE_THRESHOLD;
+    state->closed_loop = CLOSED_LOOP_SPEED;
+    state->proportional_steering = PROPORTIONAL_STEERING;
+    LineEstimator_Init(&state->line);
+    WheelPid_Init(&state->steering, STEERING_KP, STEERING_KI, STEERING_KD, 0.0f, MOTOR_DUTY_MAX);
+    state->steering_stamp_ns = 0;
+    memset(&state->collision, 0, sizeof(state->collision));
+    state->speed_limit = 1.0f;
     state->p_terminate = &terminate;
 }
 
 int main(int argc, char* argv[])
 {
+    /* Optional line following policy file, reloaded on SIGHUP */
+    const char* policy_path = argc > 1 ? argv[1] : NULL;
+
+    if (policy_path != NULL && load_line_policy(policy_path)) {
+        exit(1);
+    }
     /* Initialize motor driver */
     if(DEV_ModuleInit()) {
         exit(1);
@@ -106,11 +161,19 @@ int main(int argc, char* argv[])
     }
 
     Motor_Init();
+    if (Actuator_Start())
+    {
+        fprintf(stderr, "Failed to start the motor actuator\n");
+        DEV_ModuleExit();
+        gpioTerminate();
+        exit(1);
+    }
 
     ProgramState state;
     init_program_state(&state);
 
     signal(SIGINT, handle_interrupt);
+    signal(SIGHUP, handle_hangup);
 
     /* GPIO pins for the line sensors */
     uint8_t line_sensor_pins[] = {
@@ -127,77 +190,157 @@ int main(int argc, char* argv[])
         (uint8_t)SPI0_CE1
     };
 
+    /* Counter pins are in wheel order, left (MOTORA) first */
+    WheelSpeedConfig wheel_speed_config = {
+        .chip_enable = { counter_pins[WHEEL_LEFT], counter_pins[WHEEL_RIGHT] },
+        .listener = Odometry_OnSample,
+        .listener_arg = NULL
+    };
+    Odometry_Init(ODOMETRY_TRACK_WIDTH_CM);
+    if (WheelSpeed_Start(&wheel_speed_config))
+    {
+        fprintf(stderr, "Failed to start the wheel speed service\n");
+        Actuator_Stop();
+        DEV_ModuleExit();
+        gpioTerminate();
+        exit(1);
+    }
+    if (state.closed_loop && SpeedControl_Start())
+    {
+        fprintf(stderr, "Failed to start the speed controller\n");
+        WheelSpeed_Stop();
+        Actuator_Stop();
+        DEV_ModuleExit();
+        gpioTerminate();
+        exit(1);
+    }
+
     volatile uint8_t line_sensor_vals[NUM_LINE_SENSORS] = { 0 };
-    SensorArgs* line_sensor_args[NUM_LINE_SENSORS];
-    pthread_t line_sensor_threads[NUM_LINE_SENSORS];
+#if LINE_SENSOR_EDGES
+    LineEdgeArgs line_edge_args;
+    LineSample line_sample;
+#else
+    LineSamplerArgs line_sampler_args;
+    pthread_t line_sampler_thread;
+#endif
 
-    pthread_t sonar_thread_front;
-    pthread_t sonar_thread_left;
+    pthread_t sonar_thread;
 
     SonarArgs sonar_args_front;
-    init_SonarArgs(&sonar_args_front, 
+    init_SonarArgs(&sonar_args_front, SONAR_FRONT,
         (uint8_t)PIN_SONAR_FRONT_TRIG, 
         (uint8_t)PIN_SONAR_FRONT_ECHO);
     sonar_args_front.p_terminate = &terminate;
+    set_sonar_range(&sonar_args_front, SONAR_FRONT_RANGE_CM);
+    sonar_args_front.facing_forward = true;
 
     SonarArgs sonar_args_left;
-    init_SonarArgs(&sonar_args_left, 
+    init_SonarArgs(&sonar_args_left, SONAR_LEFT,
         (uint8_t)PIN_SONAR_LEFT_TRIG, 
         (uint8_t)PIN_SONAR_LEFT_ECHO);
     sonar_args_left.p_terminate = &terminate;
+    set_sonar_range(&sonar_args_left, SONAR_LEFT_RANGE_CM);
+
+    /* One scheduler pings the sonars in turn, front first */
+    SonarArgs* sonars[] = { &sonar_args_front, &sonar_args_left };
+    SonarSchedulerArgs sonar_scheduler_args;
+    init_SonarSchedulerArgs(&sonar_scheduler_args, sonars, 2);
+    sonar_scheduler_args.p_terminate = &terminate;
 
-    /* Create thread routines for the line sensors */
-    for (size_t i = 0; i < NUM_LINE_SENSORS; i++)
+#if LINE_SENSOR_FILTERED
+    if (set_line_glitch_filter(line_sensor_pins, NUM_LINE_SENSORS, LINE_GLITCH_FILTER_US))
+    {
+        fprintf(stderr, "Failed to set the line sensor glitch filter\n");
+    }
+#endif
+#if LINE_SENSOR_EDGES
+    /* Have pigpio report line sensor transitions as they happen */
+    if (start_line_edges(&line_edge_args, line_sensor_pins, NUM_LINE_SENSORS, line_sensor_vals,
+        LINE_SENSOR_FILTERED ? LINE_FILTER_WINDOW_US : 0))
     {
-        line_sensor_args[i] = malloc(sizeof(SensorArgs));
-        line_sensor_args[i]->p_sensor_val = &line_sensor_vals[i];
-        line_sensor_args[i]->gpio_pin = line_sensor_pins[i];
-        line_sensor_args[i]->p_terminate = &terminate;
-        pthread_create(&line_sensor_threads[i], NULL, read_sensor, (void*)line_sensor_args[i]);
+        fprintf(stderr, "Failed to register the line sensor alerts\n");
+        SpeedControl_Stop();
+        WheelSpeed_Stop();
+        Actuator_Stop();
+        DEV_ModuleExit();
+        gpioTerminate();
+        exit(1);
     }
-    /* Create thread routines for the sonar sensors */
-    pthread_create(&sonar_thread_front, NULL, watch_sonar, (void*)&sonar_args_front);
-    pthread_create(&sonar_thread_left, NULL, watch_sonar, (void*)&sonar_args_left);
+#else
+    /* Create one thread routine to sample all of the line sensors */
+    init_LineSamplerArgs(&line_sampler_args, line_sensor_pins, NUM_LINE_SENSORS, line_sensor_vals,
+        LINE_SENSOR_FILTERED ? LINE_FILTER_WINDOW_US : 0);
+    line_sampler_args.p_terminate = &terminate;
+    pthread_create(&line_sampler_thread, NULL, 
+        (void* (*)(void*))sample_line_sensors, (void*)&line_sampler_args);
+#endif
+    /* Create one thread routine to ping all of the sonar sensors */
+    pthread_create(&sonar_thread, NULL, 
+        (void* (*)(void*))run_sonar_scheduler, (void*)&sonar_scheduler_args);
 
     /* Directions must be alternated because the motors are mounted
      * in opposite orientations. Both motors will turn forward relative 
      * to the car. */
-    Motor_Run(MOTOR_LEFT, MOTOR_LEFT_FORWARD, state.speed_left);
-    Motor_Run(MOTOR_RIGHT, MOTOR_RIGHT_FORWARD, state.speed_right);
+    drive(&state, FORWARD, state.speed_left, state.speed_right);
 
-    float front_obstacle_range_cm = 10.0f;
     float left_obstacle_range_cm = 30.0f;
+    SensorSnapshot sensors;
+    uint64_t stopped_ns = 0;    /* When the car stopped for an obstacle */
 
     while (!terminate)
     {
-        if (object_present(&sonar_args_front, front_obstacle_range_cm)) {
-            /* Wait for 1 second to see if the object goes away */
-            Motor_Stop(MOTOR_LEFT);
-            Motor_Stop(MOTOR_RIGHT);
-            usleep(1000000);
-            /* If the object is still present, go around it */
-            if (object_present(&sonar_args_front, front_obstacle_range_cm)) {
-                avoid_obstacle(&sonar_args_front, &sonar_args_left, &state, line_sensor_vals);
+        if (reload_policy) {
+            reload_policy = false;
+            if (policy_path != NULL && load_line_policy(policy_path) == 0) {
+                printf("Loaded line policy %s\n", policy_path);
             }
-            else {
-                Motor_Run(MOTOR_LEFT, MOTOR_LEFT_FORWARD, state.speed_left);
-                Motor_Run(MOTOR_RIGHT, MOTOR_RIGHT_FORWARD, state.speed_right);
-            }
-
         }
-        follow_line(line_sensor_vals, &state);
-        usleep(1000);
-    }
-    pthread_join(sonar_thread_front, NULL);
-    pthread_join(sonar_thread_left, NULL);
-
-    /* Clean up the line sensor thread routines and memory */
-    for (size_t i = 0; i < NUM_LINE_SENSORS; i++)
-    {
-        pthread_join(line_sensor_threads[i], NULL);
-        free(line_sensor_args[i]);
-        line_sensor_args[i] = NULL;
+        /* Make every decision in this pass from the same sensor state */
+        get_sensor_snapshot(&sensors);
+
+        /* Slow down as the time to collision with anything ahead drops */
+        estimate_collision(&state.collision, &sensors, SONAR_FRONT, requested_speed_cm_s(&state));
+        limit_speed(&state, collision_speed_limit(&state.collision));
+        if (!state.collision.holding) {
+            stopped_ns = 0;
+        }
+        else if (stopped_ns == 0) {
+            stopped_ns = sensors.taken_ns;
+        }
+        else if (sensors.taken_ns - stopped_ns >= OBSTACLE_WAIT_MS * TIMING_NS_PER_MS) {
+            /* The object has not gone away, so go around it */
+            state.speed_limit = 1.0f;
+            state.collision.holding = false;
+            stopped_ns = 0;
+            avoid_obstacle(&sonar_args_front, &sonar_args_left, &state, line_sensor_vals);
+            continue;
+        }
+        follow_line_mask(sensors.line_mask, sensors.line_stamp_ns, &state);
+#if LINE_SENSOR_EDGES
+        /* Sleep until the line pattern changes, or for one control period */
+        wait_line_change(&line_edge_args, &line_sample, CONTROL_PERIOD_US);
+#else
+        usleep(CONTROL_PERIOD_US);
+#endif
     }
+    pthread_join(sonar_thread, NULL);
+    print_sonar_scheduler_stats(&sonar_scheduler_args);
+    print_sonar_stats(&sonar_args_front, "front");
+    print_sonar_stats(&sonar_args_left, "left");
+
+#if LINE_SENSOR_EDGES
+    stop_line_edges(&line_edge_args);
+    print_line_edge_stats(&line_edge_args);
+#else
+    pthread_join(line_sampler_thread, NULL);
+    print_line_sampler_stats(&line_sampler_args);
+#endif
+    SpeedControl_Stop();
+    SpeedControl_PrintStats();
+    WheelSpeed_Stop();
+    WheelSpeed_PrintStats();
+    Actuator_Stop();
+    Actuator_PrintStats();
     Motor_Stop(MOTORA);
     Motor_Stop(MOTORB);
 
@@ -17,12 +17,64 @@
 ******************************************************************************/
 
 
-#include <time.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "movement.h"
 #include "sensor.h"
+#include "Timing.h"
+#include "follow_line_policy.h"
+
+
+/* Names of the actions in policy files, in LineAction order */
+static const char* const line_action_names[NUM_LINE_ACTIONS] = {
+    "HOLD", "LEFT", "RIGHT", "STRAIGHT", "LAST", "OUTER_LEFT", "OUTER_RIGHT"
+};
+
+/* Table used by line_policy_action(), swapped whole when a policy is loaded */
+static _Atomic(const LinePolicy*) line_policy = &follow_line_default_policy;
 
 
+/**
+ * Clamp a requested motor speed to the valid duty cycle range.
+ */
+static UWORD clamp_speed(int speed)
+{
+    if (speed < 0) {
+        return 0;
+    }
+    if (speed > MOTOR_DUTY_MAX) {
+        return MOTOR_DUTY_MAX;
+    }
+    return (UWORD)speed;
+}
+
+/**
+ * Send a motor command. Speeds are duty cycles (0 ~ MOTOR_DUTY_MAX).
+ * Forward speeds are scaled by the braking speed limit.
+ *
+ * In closed loop mode the speed controller owns the actuator, so the 
+ * duty cycles are converted to wheel speeds and handed to it instead.
+ */
+void drive(ProgramState* state, DIR dir, UWORD speed_left, UWORD speed_right)
+{
+    if (dir == FORWARD && state->speed_limit < 1.0f) {
+        speed_left = (UWORD)(speed_left * state->speed_limit + 0.5f);
+        speed_right = (UWORD)(speed_right * state->speed_limit + 0.5f);
+    }
+    if (state->closed_loop) {
+        SpeedControl_SetTarget(dir, 
+            SPEED_CONTROL_DUTY_TO_CM_S(speed_left), 
+            SPEED_CONTROL_DUTY_TO_CM_S(speed_right));
+    }
+    else {
+        Actuator_Publish(dir, speed_left, speed_right);
+    }
+}
+
 /**
  * Helper function to increment a confidence value
  * without exceeding the maximum.
@@ -49,10 +101,11 @@ void turn_left(ProgramState* state, uint8_t* confidence)
     if (state->last_req == LEFT)
     {
         increment_confidence(confidence);
-        if (*confidence >= CONFIDENCE_THRESHOLD)
+        if (*confidence >= state->confidence_threshold)
         {
-            state->speed_left = Motor_Decrease_Speed(MOTOR_LEFT, state->speed_left, state->speed_left - 5, 1);
-            state->speed_right = Motor_Increase_Speed(MOTOR_RIGHT, state->speed_right, state->speed_right + 5, 1);
+            state->speed_left = clamp_speed(state->speed_left - STEER_STEP);
+            state->speed_right = clamp_speed(state->speed_right + STEER_STEP);
+            drive(state, FORWARD, state->speed_left, state->speed_right);
             state->last_dir = LEFT;
         }
     }
@@ -77,10 +130,11 @@ void turn_right(ProgramState* state, uint8_t* confidence)
     if (state->last_req == RIGHT) 
     {
         increment_confidence(confidence);
-        if (*confidence >= CONFIDENCE_THRESHOLD)
+        if (*confidence >= state->confidence_threshold)
         {
-            state->speed_left = Motor_Increase_Speed(MOTOR_LEFT, state->speed_left, state->speed_left + 5, 1);
-            state->speed_right = Motor_Decrease_Speed(MOTOR_RIGHT, state->speed_right, state->speed_right - 5, 1);
+            state->speed_left = clamp_speed(state->speed_left + STEER_STEP);
+            state->speed_right = clamp_speed(state->speed_right - STEER_STEP);
+            drive(state, FORWARD, state->speed_left, state->speed_right);
             state->last_dir = RIGHT;
         }
     }
@@ -109,10 +163,11 @@ void go_straight(ProgramState* state, uint8_t* confidence)
         if (*confidence < CONFIDENCE_MAX) {
             ++(*confidence);
         }
-        if (*confidence >= CONFIDENCE_THRESHOLD)
+        if (*confidence >= state->confidence_threshold)
         {
-            state->speed_left = Motor_Increase_Speed(MOTOR_LEFT, state->speed_left, 100, 5);
-            state->speed_right = Motor_Increase_Speed(MOTOR_RIGHT, state->speed_right, 100, 5);
+            state->speed_left = MOTOR_DUTY_MAX;
+            state->speed_right = MOTOR_DUTY_MAX;
+            drive(state, FORWARD, state->speed_left, state->speed_right);
             state->last_dir = STRAIGHT;
         }
     }
@@ -123,12 +178,125 @@ void go_straight(ProgramState* state, uint8_t* confidence)
 }
 
 
+static LineAction parse_line_action(const char* name)
+{
+    for (int i = 0; i < NUM_LINE_ACTIONS; i++) {
+        if (strcmp(name, line_action_names[i]) == 0) {
+            return (LineAction)i;
+        }
+    }
+    return NUM_LINE_ACTIONS;
+}
+
+/**
+ * Load a line following policy file and make it the active policy.
+ *
+ * The file has the same format as policy/follow_line.policy: each rule
+ * is five sensor states (0, 1 or x) followed by an action, and the first
+ * rule matching a sensor mask decides its action. The new table replaces
+ * the old one with a single pointer swap, so this is safe to call while
+ * the car is driving. Replaced tables are not freed, because the control
+ * loop may still be reading one.
+ *
+ * Returns 0 on success, or -1 if the file cannot be read or does not
+ * give an action for every sensor mask. The active policy is unchanged
+ * on failure.
+ */
+int load_line_policy(const char* path)
+{
+    LinePolicy* policy;
+    bool assigned[LINE_POLICY_SIZE] = { false };
+    char line[128];
+    char state[LINE_POLICY_SENSORS];
+    char name[32];
+    uint32_t care, value;
+    LineAction action;
+    int line_num = 0;
+    int fields;
+    FILE* file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "%s: cannot open line policy\n", path);
+        return -1;
+    }
+    policy = malloc(sizeof(*policy));
+    if (policy == NULL) {
+        fclose(file);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL)
+    {
+        line_num++;
+        line[strcspn(line, "#\r\n")] = '\0';
+        fields = sscanf(line, " %c %c %c %c %c %31s",
+            &state[0], &state[1], &state[2], &state[3], &state[4], name);
+        if (fields == EOF) {
+            continue;
+        }
+        action = fields == LINE_POLICY_SENSORS + 1 ? parse_line_action(name) : NUM_LINE_ACTIONS;
+        care = 0;
+        value = 0;
+        for (int i = 0; i < LINE_POLICY_SENSORS && action != NUM_LINE_ACTIONS; i++) {
+            if (state[i] == '0' || state[i] == '1') {
+                care |= 1u << i;
+                value |= (uint32_t)(state[i] - '0') << i;
+            }
+            else if (state[i] != 'x' && state[i] != 'X') {
+                action = NUM_LINE_ACTIONS;
+            }
+        }
+        if (action == NUM_LINE_ACTIONS) {
+            fprintf(stderr, "%s:%d: expected five sensor states (0, 1 or x) and an action\n",
+                path, line_num);
+            fclose(file);
+            free(policy);
+            return -1;
+        }
+
+        for (uint32_t mask = 0; mask < LINE_POLICY_SIZE; mask++) {
+            if (!assigned[mask] && (mask & care) == value) {
+                policy->action[mask] = (uint8_t)action;
+                assigned[mask] = true;
+            }
+        }
+    }
+    fclose(file);
+
+    for (uint32_t mask = 0; mask < LINE_POLICY_SIZE; mask++) {
+        if (!assigned[mask]) {
+            fprintf(stderr, "%s: no rule matches sensor mask 0x%02x\n", path, mask);
+            free(policy);
+            return -1;
+        }
+    }
+    atomic_store_explicit(&line_policy, policy, memory_order_release);
+    return 0;
+}
+
+/**
+ * The action the active line policy gives for a sensor mask.
+ */
+LineAction line_policy_action(uint32_t mask)
+{
+    const LinePolicy* policy = atomic_load_explicit(&line_policy, memory_order_acquire);
+
+    return (LineAction)policy->action[mask & (LINE_POLICY_SIZE - 1)];
+}
+
 /**
- * Evaluate the line sensor values and take the appropriate action 
- * to follow the line.
+ * The original ordered if/else evaluation of the line sensors, which
+ * policy/follow_line.policy replaces. Kept as the reference the default
+ * table is checked against, see tests/bench_line_policy.c.
  */
-void follow_line(uint8_t line_sensor_vals[], ProgramState* state)
+LineAction follow_line_reference(uint32_t mask)
 {
+    bool on[LINE_POLICY_SENSORS];
+
+    for (int i = 0; i < LINE_POLICY_SENSORS; i++) {
+        on[i] = (mask >> i) & 1;
+    }
+
     /* IMPORTANT: The sensor evaluations must be performed in exactly this order.
      * (from most specific, to least). 
      *
@@ -140,59 +308,262 @@ void follow_line(uint8_t line_sensor_vals[], ProgramState* state)
      * active will get skipped over.
      */
     /* Right and outer-right */
-    if (line_sensor_vals[3] == HIGH && line_sensor_vals[4] == LOW)
+    if (on[3] && !on[4])
     {
-        turn_left(state, &(state->outer_confidence));
+        return LINE_OUTER_LEFT;
     }
     /* Left and outer-left */
-    else if (line_sensor_vals[3] == LOW && line_sensor_vals[4] == HIGH)
+    else if (!on[3] && on[4])
     {
-        turn_right(state, &(state->outer_confidence));
+        return LINE_OUTER_RIGHT;
     }
-    else {
-        state->outer_confidence = 0;
+    /* (1, 1, 1) All three sensors are on */
+    else if (on[0] && on[1] && on[2]) {
+        return LINE_HOLD;
+    }
+    /* (1, 1, 0) LEFT and CENTER */
+    else if (on[0] && on[1]) {
+        return LINE_LEFT;
+    }
+    /* (0, 1, 1) CENTER and RIGHT */
+    else if (on[1] && on[2]) {
+        return LINE_RIGHT;
+    }
+    /* (1, 0, 1) LEFT and RIGHT */
+    else if (on[0] && on[2]) {
+        return LINE_HOLD;
+    }
+    /* (1, 0, 0) LEFT only */
+    else if (on[0]) {
+        return LINE_LEFT;
+    }
+    /* (0, 1, 0) CENTER only */
+    else if (on[1]) {
+        return LINE_STRAIGHT;
+    }
+    /* (0, 0, 1) RIGHT only */
+    else if (on[2]) {
+        return LINE_RIGHT;
+    }
+    /* (0, 0, 0) no sensors active, fall back on the last attempted direction */
+    return LINE_LAST;
+}
 
-        /* (1, 1, 1) All three sensors are on */
-        if (line_sensor_vals[0] == HIGH && line_sensor_vals[1] == HIGH && line_sensor_vals[2] == HIGH) {
-        /* Keep performing the current action */
-        }
-        /* (1, 1, 0) LEFT and CENTER */
-        else if (line_sensor_vals[0] == HIGH && line_sensor_vals[1] == HIGH) {
-            turn_left(state, &(state->inner_confidence));
-        }
-        /* (0, 1, 1) CENTER and RIGHT */
-        else if (line_sensor_vals[1] == HIGH && line_sensor_vals[2] == HIGH) {
+/**
+ * Take the action the active line policy gives for a sensor mask,
+ * where bit i is set when line sensor i is on the line.
+ */
+void apply_line_policy(uint32_t mask, ProgramState* state)
+{
+    switch (line_policy_action(mask))
+    {
+    case LINE_OUTER_LEFT:
+        turn_left(state, &(state->outer_confidence));
+        return;
+    case LINE_OUTER_RIGHT:
+        turn_right(state, &(state->outer_confidence));
+        return;
+    case LINE_LEFT:
+        state->outer_confidence = 0;
+        turn_left(state, &(state->inner_confidence));
+        return;
+    case LINE_RIGHT:
+        state->outer_confidence = 0;
+        turn_right(state, &(state->inner_confidence));
+        return;
+    case LINE_STRAIGHT:
+        state->outer_confidence = 0;
+        go_straight(state, &(state->inner_confidence));
+        return;
+    case LINE_LAST:
+        state->outer_confidence = 0;
+        if (state->last_dir == RIGHT) {
             turn_right(state, &(state->inner_confidence));
         }
-        /* (1, 0, 1) LEFT and RIGHT */
-        else if (line_sensor_vals[0] == HIGH && line_sensor_vals[2] == HIGH) {
-        /* Keep performing the current action */
-        }
-        /* (1, 0, 0) LEFT only */
-        else if (line_sensor_vals[0] == HIGH) {
+        else if (state->last_dir == LEFT) {
             turn_left(state, &(state->inner_confidence));
         }
-        /* (0, 1, 0) CENTER only */
-        else if (line_sensor_vals[1] == HIGH) {
-            go_straight(state, &(state->inner_confidence));
-        }
-        /* (0, 0, 1) RIGHT only */
-        else if (line_sensor_vals[2] == HIGH) {
-            turn_right(state, &(state->inner_confidence));
-        }
-        /* (0, 0, 0) no sensors active */
-        else  {
-            /* Fall back on the last attempted direction */
-            if (state->last_dir == RIGHT) {
-                turn_right(state, &(state->inner_confidence));
-            }
-            else if (state->last_dir == LEFT) {
-                turn_left(state, &(state->inner_confidence));
-            }
+        return;
+    default:
+        /* Keep performing the current action */
+        state->outer_confidence = 0;
+        return;
+    }
+}
+
+/**
+ * Steer on the continuous line position estimate. The steering 
+ * controller output slows the wheel on the inside of the turn in 
+ * proportion to the line error, instead of stepping the speeds.
+ *
+ * stamp_ns is when the line sample was taken. The controller steps
+ * over the time between samples, at least STEERING_MIN_DT_S, rather
+ * than the time between wakeups. A repeated sample still advances the
+ * estimate, but only the proportional term acts on it.
+ */
+void steer_to_line(ProgramState* state, uint32_t mask, uint64_t stamp_ns)
+{
+    float dt_s = 0.0f;
+    float steer;
+    UWORD left, right;
+
+    if (stamp_ns > state->steering_stamp_ns) {
+        if (state->steering_stamp_ns != 0) {
+            dt_s = fmaxf((stamp_ns - state->steering_stamp_ns) / 1e9f, STEERING_MIN_DT_S);
         }
+        state->steering_stamp_ns = stamp_ns;
+    }
+    LineEstimator_Update(&state->line, mask, Timing_NowNs());
+
+    /* Positive steers right, toward a line on the right */
+    steer = -WheelPid_Update(&state->steering, 0.0f, state->line.error, dt_s);
+    left = clamp_speed(MOTOR_DUTY_MAX - (int)fmaxf(0.0f, -steer));
+    right = clamp_speed(MOTOR_DUTY_MAX - (int)fmaxf(0.0f, steer));
+    if (left != state->speed_left || right != state->speed_right) {
+        state->speed_left = left;
+        state->speed_right = right;
+        drive(state, FORWARD, left, right);
+    }
+    state->last_dir = steer > 0.0f ? RIGHT : (steer < 0.0f ? LEFT : STRAIGHT);
+}
+
+/**
+ * Follow the line given a mask of the line sensors, where bit i is 
+ * set when line sensor i is on the line, sampled at stamp_ns.
+ */
+void follow_line_mask(uint32_t mask, uint64_t stamp_ns, ProgramState* state)
+{
+    if (state->proportional_steering) {
+        steer_to_line(state, mask, stamp_ns);
+    }
+    else {
+        apply_line_policy(mask, state);
+    }
+}
+
+/**
+ * Mean forward speed asked of the motors, before any braking.
+ */
+float requested_speed_cm_s(const ProgramState* state)
+{
+    return SPEED_CONTROL_DUTY_TO_CM_S((state->speed_left + state->speed_right) / 2.0f);
+}
+
+/**
+ * Estimate the time to collision with the object seen by a sonar.
+ *
+ * The closing speed combines the two sensors: the encoders give the
+ * car's own speed with no delay, while the sonar range rate, less the
+ * car's speed, gives the speed of the object itself. That part is 
+ * smoothed, since the range rate is noisy and lags changes in the 
+ * car's speed. Without odometry the sonar range rate is used alone.
+ *
+ * The car's own part is at least the requested speed, so the time is
+ * what it would be if the brakes were let off. Otherwise a car slowed
+ * by braking would see the time grow and speed up again.
+ *
+ * The time is measured to OBSTACLE_STOP_CM short of the object, and 
+ * only a trusted range is used.
+ */
+void estimate_collision(CollisionEstimate* est, const SensorSnapshot* sensors, uint8_t sonar_id,
+    float requested_cm_s)
+{
+    OdometryPose pose;
+    bool have_speed = Odometry_Valid() && Odometry_GetPose(&pose);
+    float car_cm_s = have_speed ? fmaxf(pose.v_cm_s, 0.0f) : 0.0f;
+    float own_cm_s = fmaxf(car_cm_s, requested_cm_s);
+
+    est->requested_cm_s = requested_cm_s;
+    if (!sonar_detects(sensors, sonar_id, SONAR_MAX_DISTANCE_CM, SONAR_MAX_AGE_MS)) {
+        est->ttc_s = INFINITY;
+        est->range_cm = 0.0f;
+        est->closing_cm_s = own_cm_s;
+        est->object_cm_s = 0.0f;
+        est->may_creep = true;
+        est->stamp_ns = 0;
+        return;
+    }
+
+    est->range_cm = sensors->sonar_cm[sonar_id];
+    if (sensors->sonar_stamp_ns[sonar_id] != est->stamp_ns) {
+        est->object_cm_s += TTC_OBJECT_SMOOTHING 
+            * (sensors->sonar_closing_cm_s[sonar_id] - car_cm_s - est->object_cm_s);
+        est->stamp_ns = sensors->sonar_stamp_ns[sonar_id];
+    }
+    est->closing_cm_s = have_speed 
+        ? own_cm_s + est->object_cm_s 
+        : fmaxf(sensors->sonar_closing_cm_s[sonar_id], requested_cm_s);
+
+    /* Without odometry the object can't be told apart from the car,
+     * so allow for the car's own creep as well */
+    est->may_creep = have_speed 
+        ? est->object_cm_s < OBSTACLE_CREEP_CM_S
+        : sensors->sonar_closing_cm_s[sonar_id] < 2.0f * OBSTACLE_CREEP_CM_S;
+
+    if (est->closing_cm_s <= 0.0f) {
+        est->ttc_s = INFINITY;
+    }
+    else {
+        est->ttc_s = fmaxf(est->range_cm - OBSTACLE_STOP_CM, 0.0f) / est->closing_cm_s;
     }
 }
 
+/**
+ * Braking policy: the fraction of the requested forward speed to
+ * allow. Full speed down to TTC_BRAKE_S, then slowing linearly to a
+ * stop at TTC_STOP_S. While slowing, an object which comes closer by
+ * itself slower than OBSTACLE_CREEP_CM_S is approached at no less
+ * than that speed, so the car gets near it instead of slowing toward
+ * it forever.
+ *
+ * Once the car stops, at TTC_STOP_S or at OBSTACLE_STOP_CM, it holds.
+ * It only lets go when a trusted range shows the object further away
+ * than OBSTACLE_RELEASE_CM, with the time to collision back above
+ * TTC_BRAKE_S. Losing the track keeps the hold, so a dropout can't
+ * restart the car.
+ */
+float collision_speed_limit(CollisionEstimate* est)
+{
+    float limit;
+
+    if (est->range_cm > 0.0f && est->range_cm <= OBSTACLE_STOP_CM) {
+        est->holding = true;
+    }
+    else if (est->ttc_s <= TTC_STOP_S) {
+        est->holding = true;
+    }
+    else if (est->range_cm > OBSTACLE_RELEASE_CM && est->ttc_s >= TTC_BRAKE_S) {
+        est->holding = false;
+    }
+    if (est->holding) {
+        return 0.0f;
+    }
+
+    if (est->ttc_s >= TTC_BRAKE_S) {
+        return 1.0f;
+    }
+    limit = (est->ttc_s - TTC_STOP_S) / (TTC_BRAKE_S - TTC_STOP_S);
+    if (est->may_creep && est->requested_cm_s > 0.0f) {
+        limit = fmaxf(limit, fminf(OBSTACLE_CREEP_CM_S / est->requested_cm_s, 1.0f));
+    }
+    return limit;
+}
+
+/**
+ * Change the forward speed limit, and resend the current speeds if 
+ * it changed enough to matter.
+ */
+void limit_speed(ProgramState* state, float limit)
+{
+    limit = fminf(fmaxf(limit, 0.0f), 1.0f);
+    if (limit == state->speed_limit
+        || (fabsf(limit - state->speed_limit) < SPEED_LIMIT_STEP && limit != 0.0f && limit != 1.0f)) {
+        return;
+    }
+    state->speed_limit = limit;
+    drive(state, FORWARD, state->speed_left, state->speed_right);
+}
+
 /**
  * Avoid an obstacle using input from the sonar sensors.
  * Navigate around the obstacle by moving in a large rectangle around the object's bounding region.\
@@ -218,6 +589,8 @@ void avoid_obstacle(SonarArgs* args_front, SonarArgs* args_left, ProgramState* s
 
     int attempts = 3;
 
+    /* The obstacle is passed on the left, so watch that side most */
+    prioritize_sonar(args_left);
     turn_90(state, RIGHT);
 
     /* Go forward as long as there is an object to the left */
@@ -304,6 +677,7 @@ void avoid_obstacle(SonarArgs* args_front, SonarArgs* args_left, ProgramState* s
     }
     printf("LINE DETECTED\n");
     turn_90(state, RIGHT);
+    prioritize_sonar(args_front);
 }
 
 /**
@@ -318,24 +692,20 @@ void set_turn_direction(ProgramState* state, DIR dir)
         case LEFT:
             printf("LEFT\n");
             // turn left motor backwards, right forward
-            Motor_Set_Direction(MOTOR_LEFT, MOTOR_LEFT_BACKWARD, 100);
-            Motor_Set_Direction(MOTOR_RIGHT, MOTOR_RIGHT_FORWARD, 100);
+            drive(state, LEFT, MOTOR_DUTY_MAX, MOTOR_DUTY_MAX);
             break;
         case RIGHT:
             printf("RIGHT\n");
             // turn left motor forward, right backward
-            Motor_Set_Direction(MOTOR_LEFT, MOTOR_LEFT_FORWARD, 100);
-            Motor_Set_Direction(MOTOR_RIGHT, MOTOR_RIGHT_BACKWARD, 100);
+            drive(state, RIGHT, MOTOR_DUTY_MAX, MOTOR_DUTY_MAX);
             break;
         case FORWARD:
             printf("FORWARD\n");
-            Motor_Set_Direction(MOTOR_LEFT, MOTOR_LEFT_FORWARD, 100);
-            Motor_Set_Direction(MOTOR_RIGHT, MOTOR_RIGHT_FORWARD, 100);
+            drive(state, FORWARD, MOTOR_DUTY_MAX, MOTOR_DUTY_MAX);
             break;
         case BACKWARD:
             printf("BACKWARD\n");
-            Motor_Set_Direction(MOTOR_LEFT, MOTOR_LEFT_BACKWARD, 100);
-            Motor_Set_Direction(MOTOR_RIGHT, MOTOR_RIGHT_BACKWARD, 100);
+            drive(state, BACKWARD, MOTOR_DUTY_MAX, MOTOR_DUTY_MAX);
             break;
         default:
             break;
@@ -343,19 +713,50 @@ void set_turn_direction(ProgramState* state, DIR dir)
 }
 
 /**
- * Perform a 90 degree turn in the specified direction.
+ * Spin in place in the specified direction until the heading has 
+ * changed by the given angle. The motors are left running.
+ *
+ * If odometry is unavailable, the car turns for fallback_us instead.
+ * Otherwise the turn gives up after twice that long, in case the 
+ * encoders stop updating part way through.
+ *
+ * Returns true if the angle was measured to be reached.
+ */
+bool turn_angle(ProgramState* state, DIR dir, float degrees, long fallback_us)
+{
+    const float target_rad = degrees * (float)PI / 180.0f;
+    OdometryPose start, pose;
+    uint64_t deadline_ns;
+
+    set_turn_direction(state, dir);
+    if (!Odometry_Valid() || !Odometry_GetPose(&start)) {
+        usleep(fallback_us);
+        return false;
+    }
+    deadline_ns = Timing_Deadline(2 * fallback_us * TIMING_NS_PER_US);
+    while (!*(state->p_terminate) && !Timing_Expired(deadline_ns)) {
+        Odometry_GetPose(&pose);
+        if (fabsf(pose.turned_rad - start.turned_rad) >= target_rad) {
+            return true;
+        }
+        usleep(MANEUVER_POLL_US);
+    }
+    return false;
+}
+
+/**
+ * Perform a 90 degree turn in the specified direction, measured
+ * with odometry when it is available.
  */
 void turn_90(ProgramState* state, DIR dir)
 {
     if (dir == LEFT)
     {
-        set_turn_direction(state, dir);
-        usleep(1100000);
+        turn_angle(state, dir, 90.0f, TURN_90_LEFT_US);
     }
     else if (dir == RIGHT) 
     {
-        set_turn_direction(state, dir);
-        usleep(1000000);
+        turn_angle(state, dir, 90.0f, TURN_90_RIGHT_US);
     }
     set_turn_direction(state, FORWARD);
 }
@@ -25,14 +25,37 @@
 #include "sonar.h"
 #include "definitions.h"
 #include "MotorDriver.h"
+#include "MotorActuator.h"
+#include "SpeedController.h"
+#include "Odometry.h"
+#include "LineEstimator.h"
 
 #define MOTOR_LEFT  MOTORA
 #define MOTOR_RIGHT MOTORB
 
 
+/* Duty cycle shifted between the wheels per steering correction */
+#define STEER_STEP MOTOR_DUTY_PERCENT(5)
+
 #define CONFIDENCE_THRESHOLD 8
+/* Majority-voted line samples need less confirmation before steering.
+ * The polling loop passes once per control period, and the edge waiter
+ * only wakes the loop early when the vote changes, so passes which see
+ * the same vote are a control period apart on either path. */
+#define FILTERED_CONFIDENCE_THRESHOLD 2
 #define CONFIDENCE_MAX 100
 
+/* Proportional steering on the line position estimate. The output is
+ * the duty cycle taken off the inside wheel, per cm of line error. */
+#define STEERING_KP MOTOR_DUTY_PERCENT(15.0f)
+#define STEERING_KI 0.0f
+#define STEERING_KD MOTOR_DUTY_PERCENT(0.5f)
+
+/* Shortest time step the steering derivative is taken over. Line
+ * edges can arrive microseconds apart, and the derivative over such
+ * a step would saturate the output. */
+#define STEERING_MIN_DT_S 0.02f
+
 /* Angles of view if checking for obstacle in front, left, or right */
 #define FRONTVIEW_LEFT 315.0f
 #define FRONTVIEW_RIGHT 45.0f
@@ -45,29 +68,117 @@
 
 #define OBSTACLE_DISTANCE 475.0f
 
+/* Time taken by a 90 degree turn, used when odometry is unavailable.
+ * With odometry, turns give up after twice this long. */
+#define TURN_90_LEFT_US     1100000
+#define TURN_90_RIGHT_US    1000000
+
+/* Odometry polling period during a maneuver */
+#define MANEUVER_POLL_US    5000
+
+/* Braking on the time to collision with the object ahead, at the
+ * requested forward speed. Forward speed is scaled down linearly from
+ * full at TTC_BRAKE_S to a stop at TTC_STOP_S. On the way, the car
+ * keeps at least OBSTACLE_CREEP_CM_S toward an object which comes
+ * closer by itself slower than that. Collision is counted at
+ * OBSTACLE_STOP_CM. Once stopped, the car holds until the object is
+ * seen further away than OBSTACLE_RELEASE_CM. */
+#define TTC_BRAKE_S         1.0f
+#define TTC_STOP_S          0.25f
+#define OBSTACLE_STOP_CM    10.0f
+#define OBSTACLE_RELEASE_CM 20.0f
+#define OBSTACLE_CREEP_CM_S 8.0f
+
+/* Weight of each new sonar estimate in the smoothed speed of the
+ * object itself, apart from the car's own speed */
+#define TTC_OBJECT_SMOOTHING 0.2f
+
+/* Smallest change in the speed limit worth sending to the motors */
+#define SPEED_LIMIT_STEP    0.02f
+
+/* Time stopped at an obstacle before going around it */
+#define OBSTACLE_WAIT_MS    1000
+
+/* Line following table: one action per mask of the five line sensors
+ * (front-left, front-center, front-right, rear-left, rear-right) */
+#define LINE_POLICY_SENSORS 5
+#define LINE_POLICY_SIZE    (1 << LINE_POLICY_SENSORS)
+
 typedef enum {
     LINE,
     OBSTACLE
 } MODE;
 
+/* Actions a line following policy can take. The names without the
+ * LINE_ prefix are used in policy files. */
+typedef enum {
+    LINE_HOLD,          /* Keep performing the current action */
+    LINE_LEFT,          /* Steer on the front (inner) sensors */
+    LINE_RIGHT,
+    LINE_STRAIGHT,
+    LINE_LAST,          /* Fall back on the last successful direction */
+    LINE_OUTER_LEFT,    /* Steer on the rear (outer) sensors */
+    LINE_OUTER_RIGHT,
+    NUM_LINE_ACTIONS
+} LineAction;
+
+typedef struct {
+    uint8_t action[LINE_POLICY_SIZE];   /* LineAction for each sensor mask */
+} LinePolicy;
+
+typedef struct {
+    float ttc_s;                /* Time to collision, INFINITY when not closing */
+    float range_cm;             /* Range of the object, 0 when none is tracked */
+    float closing_cm_s;         /* Combined closing speed */
+    float object_cm_s;          /* Smoothed speed of the object toward the car */
+    float requested_cm_s;       /* Forward speed asked for, before braking */
+    uint64_t stamp_ns;          /* Time of the sonar estimate last used */
+    bool may_creep;             /* The object comes closer by itself slower than creeping */
+    bool holding;               /* Stopped at the object until it is seen to move away */
+} CollisionEstimate;
+
 typedef struct
 {
     DIR last_dir;               /* Last successful direction */
     DIR last_req;               /* Last attempted direction */
-    UBYTE speed_left;           /* Speed of left motor */
-    UBYTE speed_right;          /* Speed of right motor */
+    UWORD speed_left;           /* Speed of left motor (0 ~ MOTOR_DUTY_MAX) */
+    UWORD speed_right;          /* Speed of right motor (0 ~ MOTOR_DUTY_MAX) */
     uint8_t inner_confidence;   /* Confidence for inner sensor direction */
     uint8_t outer_confidence;   /* Confidence for outer sensor direction */
+    uint8_t confidence_threshold;   /* Confidence needed before steering */
+    bool closed_loop;           /* Speeds are held by the speed controller */
+    bool proportional_steering; /* Steer on the line estimate, not the policy table */
+    LineEstimate line;          /* Line position estimate */
+    WheelPid steering;          /* Steering controller for the line estimate */
+    uint64_t steering_stamp_ns; /* Line sample the controller last stepped on */
+    CollisionEstimate collision;    /* Time to collision with the object ahead */
+    float speed_limit;          /* Fraction of forward speeds sent to the motors */
     bool* p_terminate;          /* Termination flag */
 } ProgramState;
 
+void drive(ProgramState* state, DIR dir, UWORD speed_left, UWORD speed_right);
+
 void turn_left(ProgramState* state, uint8_t* confidence);
 void turn_right(ProgramState* state, uint8_t* confidence);
 void go_straight(ProgramState* state, uint8_t* confidence);
 
+int load_line_policy(const char* path);
+LineAction line_policy_action(uint32_t mask);
+LineAction follow_line_reference(uint32_t mask);
+void apply_line_policy(uint32_t mask, ProgramState* state);
+void steer_to_line(ProgramState* state, uint32_t mask, uint64_t stamp_ns);
+void follow_line_mask(uint32_t mask, uint64_t stamp_ns, ProgramState* state);
+
 void set_turn_direction(ProgramState* state, DIR dir);
+bool turn_angle(ProgramState* state, DIR dir, float degrees, long fallback_us);
 void turn_90(ProgramState* state, DIR dir);
 
+float requested_speed_cm_s(const ProgramState* state);
+void estimate_collision(CollisionEstimate* est, const SensorSnapshot* sensors, uint8_t sonar_id, 
+    float requested_cm_s);
+float collision_speed_limit(CollisionEstimate* est);
+void limit_speed(ProgramState* state, float limit);
+
 void avoid_obstacle(SonarArgs* args_front, SonarArgs* args_left, ProgramState* state, uint8_t line_sensor_vals[]);
 
 #endif  /* _MOVEMENT_H */
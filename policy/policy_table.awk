@@ -0,0 +1,77 @@
+# Compile a line following policy into the default action table.
+#
+# Usage: awk -f policy_table.awk follow_line.policy > follow_line_policy.h
+#
+# Every one of the 32 sensor masks is resolved to the action of the
+# first rule which matches it, so the car only has to index the table.
+# Bit i of a mask is sensor i, in the order the rules list them.
+
+function fail(msg)
+{
+    printf("%s:%d: %s\n", FILENAME, FNR, msg) > "/dev/stderr"
+    failed = 1
+    exit 1
+}
+
+BEGIN {
+    split("HOLD LEFT RIGHT STRAIGHT LAST OUTER_LEFT OUTER_RIGHT", names, " ")
+    for (i in names) {
+        valid[names[i]] = 1
+    }
+    sensors = 5
+    rules = 0
+}
+
+{ sub(/#.*/, "") }
+
+NF == 0 { next }
+
+{
+    if (NF != sensors + 1) {
+        fail("expected " sensors " sensor states and an action")
+    }
+    if (!($NF in valid)) {
+        fail("unknown action " $NF)
+    }
+    rules++
+    for (i = 1; i <= sensors; i++) {
+        if ($i !~ /^[01xX]$/) {
+            fail("sensor state must be 0, 1 or x, not " $i)
+        }
+        state[rules, i - 1] = tolower($i)
+    }
+    action[rules] = $NF
+}
+
+END {
+    if (failed) {
+        exit 1
+    }
+    print "/* Generated from follow_line.policy by policy_table.awk. Do not edit. */"
+    print ""
+    print "static const LinePolicy follow_line_default_policy = { {"
+    for (mask = 0; mask < 2 ^ sensors; mask++) {
+        bits = ""
+        for (i = 0; i < sensors; i++) {
+            bits = bits " " int(mask / 2 ^ i) % 2
+        }
+        for (r = 1; r <= rules; r++) {
+            hit = 1
+            for (i = 0; i < sensors; i++) {
+                if (state[r, i] != "x" && state[r, i] != int(mask / 2 ^ i) % 2) {
+                    hit = 0
+                    break
+                }
+            }
+            if (hit) {
+                break
+            }
+        }
+        if (r > rules) {
+            printf("%s: no rule matches sensors%s\n", FILENAME, bits) > "/dev/stderr"
+            exit 1
+        }
+        printf("    %-18s /*%s */\n", "LINE_" action[r] ",", bits)
+    }
+    print "} };"
+}
@@ -18,19 +18,594 @@
 
 #include "sensor.h"
 #include <pigpio.h>
-#include <unistd.h>     /* usleep() */
 #include <stdio.h>
+#include <string.h>     /* memcpy() */
+#include <errno.h>
 
+#include "Timing.h"
+
+
+/* Shared sensor state. Any thread may publish, so writers take the
+ * sequence lock by moving it from even to odd, and readers retry if
+ * they saw it odd or changed. */
+static atomic_uint state_lock;
+static SensorSnapshot state;
+
+
+static unsigned begin_state_write(void)
+{
+    unsigned lock;
+
+    do {
+        lock = atomic_load_explicit(&state_lock, memory_order_relaxed);
+    } while ((lock & 1) || !atomic_compare_exchange_weak_explicit(&state_lock, &lock, lock + 1,
+        memory_order_relaxed, memory_order_relaxed));
+    atomic_thread_fence(memory_order_release);
+    return lock;
+}
+
+static void end_state_write(unsigned lock)
+{
+    state.seq++;
+    atomic_store_explicit(&state_lock, lock + 2, memory_order_release);
+}
+
+void publish_line_state(uint32_t mask, uint64_t stamp_ns)
+{
+    unsigned lock = begin_state_write();
+
+    state.line_mask = mask;
+    state.line_stamp_ns = stamp_ns;
+    end_state_write(lock);
+}
+
+/**
+ * Publish the filtered range of a sonar, with its variance and the
+ * speed the object is approaching at.
+ */
+void publish_sonar_range(uint8_t sonar, float distance_cm, float var_cm2, float closing_cm_s,
+    uint64_t stamp_ns)
+{
+    unsigned lock;
+
+    if (sonar >= MAX_SONARS) {
+        return;
+    }
+    lock = begin_state_write();
+    state.sonar_cm[sonar] = distance_cm;
+    state.sonar_var_cm2[sonar] = var_cm2;
+    state.sonar_closing_cm_s[sonar] = closing_cm_s;
+    state.sonar_stamp_ns[sonar] = stamp_ns;
+    end_state_write(lock);
+}
+
+/**
+ * Get a consistent copy of the state of every sensor, so that all of
+ * the decisions made from it see the same moment.
+ */
+void get_sensor_snapshot(SensorSnapshot* snapshot)
+{
+    unsigned before, after;
+
+    do {
+        before = atomic_load_explicit(&state_lock, memory_order_acquire);
+        *snapshot = state;
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&state_lock, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+
+    snapshot->taken_ns = Timing_NowNs();
+}
+
+/**
+ * Age of a field of the snapshot, in milliseconds, at the time the
+ * snapshot was taken. A field which has never been set is UINT32_MAX
+ * milliseconds old.
+ */
+uint32_t sensor_age_ms(const SensorSnapshot* snapshot, uint64_t stamp_ns)
+{
+    if (stamp_ns == 0) {
+        return UINT32_MAX;
+    }
+    if (stamp_ns >= snapshot->taken_ns) {
+        return 0;
+    }
+    return (uint32_t)((snapshot->taken_ns - stamp_ns) / 1000000ull);
+}
+
+
+/**
+ * Pack the configured pins of a GPIO bank reading into a sensor mask.
+ */
+static uint32_t line_mask(const uint8_t pins[], uint8_t num_sensors, uint32_t bank)
+{
+    uint32_t mask = 0;
+
+    for (uint8_t i = 0; i < num_sensors; i++) {
+        mask |= ((bank >> pins[i]) & 1u) << i;
+    }
+    return mask;
+}
+
+
+/**
+ * Set up a majority vote over the readings taken in window_us, when
+ * a reading is taken every period_us. The window is rounded to an odd
+ * number of readings so there are no ties; a window_us of zero passes
+ * readings through unchanged.
+ */
+void line_filter_init(LineMajorityFilter* filter, uint32_t window_us, uint32_t period_us)
+{
+    uint32_t window = period_us ? window_us / period_us : 1;
+
+    if (window < 1) {
+        window = 1;
+    }
+    if (window > LINE_FILTER_MAX_WINDOW) {
+        window = LINE_FILTER_MAX_WINDOW;
+    }
+    if (window % 2 == 0) {
+        window++;
+    }
+    memset(filter, 0, sizeof(*filter));
+    filter->window = (uint8_t)window;
+    filter->threshold = (uint8_t)(window / 2 + 1);
+}
+
+/* Add one to the count of every sensor set in the mask */
+static void count_add(uint32_t count[], uint32_t mask)
+{
+    uint32_t carry;
+
+    for (int k = 0; k < LINE_FILTER_COUNT_BITS && mask; k++) {
+        carry = count[k] & mask;
+        count[k] ^= mask;
+        mask = carry;
+    }
+}
+
+/* Subtract one from the count of every sensor set in the mask */
+static void count_sub(uint32_t count[], uint32_t mask)
+{
+    uint32_t borrow;
+
+    for (int k = 0; k < LINE_FILTER_COUNT_BITS && mask; k++) {
+        borrow = ~count[k] & mask;
+        count[k] ^= mask;
+        mask = borrow;
+    }
+}
 
 /**
- * Thread routine to monitor a line sensor.
+ * Add a reading to the window and return the filtered reading, where
+ * each sensor takes the value most of the readings in the window agree on.
+ * The first reading fills the whole window.
  */
-void read_sensor(SensorArgs* args)
+uint32_t line_filter_update(LineMajorityFilter* filter, uint32_t mask)
 {
-    while(!*(args->p_terminate))
+    uint32_t above = 0;
+    uint32_t equal = ~0u;
+
+    if (!filter->primed) {
+        for (uint8_t i = 0; i < filter->window; i++) {
+            filter->history[i] = mask;
+            count_add(filter->count, mask);
+        }
+        filter->primed = true;
+    }
+    else {
+        count_sub(filter->count, filter->history[filter->next]);
+        count_add(filter->count, mask);
+        filter->history[filter->next] = mask;
+        filter->next = filter->next + 1 == filter->window ? 0 : filter->next + 1;
+    }
+
+    /* Compare every count with the threshold, from the top bit down */
+    for (int k = LINE_FILTER_COUNT_BITS - 1; k >= 0; k--) {
+        if ((filter->threshold >> k) & 1u) {
+            equal &= filter->count[k];
+        }
+        else {
+            above |= equal & filter->count[k];
+            equal &= ~filter->count[k];
+        }
+    }
+    return above | equal;
+}
+
+/**
+ * Have pigpio ignore level changes on the line sensor pins which do
+ * not stay steady for steady_us. The filter applies to alerts, so it
+ * cleans up the edge-driven path ahead of its majority vote; the
+ * polling sampler relies on the vote alone. Returns 0 on success.
+ */
+int set_line_glitch_filter(const uint8_t pins[], uint8_t num_sensors, uint32_t steady_us)
+{
+    for (uint8_t i = 0; i < num_sensors; i++) {
+        if (gpioGlitchFilter(pins[i], steady_us) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void init_LineSamplerArgs(LineSamplerArgs* args, const uint8_t pins[], uint8_t num_sensors,
+    volatile uint8_t* p_sensor_vals, uint32_t filter_window_us)
+{
+    if (num_sensors > MAX_LINE_SENSORS) {
+        num_sensors = MAX_LINE_SENSORS;
+    }
+    memcpy(args->pins, pins, num_sensors);
+    args->num_sensors = num_sensors;
+    args->p_sensor_vals = p_sensor_vals;
+    line_filter_init(&args->filter, filter_window_us, LINE_SAMPLE_PERIOD_US);
+    args->overridden = 0;
+    args->p_terminate = NULL;
+    memset(&args->sample, 0, sizeof(args->sample));
+    args->cpu_ns = 0;
+    args->wall_ns = 0;
+}
+
+/**
+ * Thread routine which samples every line sensor at once.
+ *
+ * The whole GPIO bank is read with a single call and the configured
+ * pins are packed into a bitmask, so one thread replaces a thread per
+ * sensor. Readings are passed through the majority vote filter, and
+ * each one is published with a timestamp and sequence 
+ * number, and the per-sensor values are kept up to date for code
+ * which still reads them directly.
+ */
+void* sample_line_sensors(LineSamplerArgs* args)
+{
+    const uint64_t period_ns = LINE_SAMPLE_PERIOD_US * TIMING_NS_PER_US;
+    uint64_t start_ns = Timing_NowNs();
+    uint64_t next_ns = start_ns;
+    LineSample sample = { 0 };
+    uint32_t bank;
+
+    while (!*(args->p_terminate))
     {
-        *(args->p_sensor_val) = gpioRead(args->gpio_pin);
-        usleep(50);
+        bank = gpioRead_Bits_0_31();
+        sample.stamp_ns = Timing_NowNs();
+        sample.raw_mask = line_mask(args->pins, args->num_sensors, bank);
+        sample.mask = line_filter_update(&args->filter, sample.raw_mask);
+        if (sample.mask != sample.raw_mask) {
+            args->overridden++;
+        }
+        sample.seq++;
+        args->sample = sample;
+        publish_line_state(sample.mask, sample.stamp_ns);
+
+        for (uint8_t i = 0; i < args->num_sensors; i++) {
+            args->p_sensor_vals[i] = (sample.mask >> i) & 1u;
+        }
+
+        /* Fixed rate; if the thread falls behind, skip the missed periods */
+        Timing_NextPeriod(&next_ns, period_ns);
+        Timing_SleepUntil(next_ns);
     }
+    args->cpu_ns = Timing_ThreadCpuNs();
+    args->wall_ns = Timing_NowNs() - start_ns;
+    return NULL;
 }
 
+/**
+ * Print the sample rate and CPU usage of the sampler.
+ * Only valid once the sampler thread has exited.
+ */
+void print_line_sampler_stats(LineSamplerArgs* args)
+{
+    if (args->wall_ns == 0) {
+        return;
+    }
+    printf("Line sampler: %u samples in %.2f s (%.0f Hz, target %.0f Hz), CPU %.2f%% of one core\n",
+        args->sample.seq, args->wall_ns / 1e9,
+        args->sample.seq / (args->wall_ns / 1e9), 1e6 / LINE_SAMPLE_PERIOD_US,
+        100.0 * args->cpu_ns / args->wall_ns);
+    printf("Line sampler: majority of %u readings, %u readings changed by the filter\n",
+        args->filter.window, args->overridden);
+}
+
+
+static void record_latency(LineLatencyHistogram* hist, uint32_t latency_us)
+{
+    int i = 0;
+
+    while (i < LINE_LATENCY_BUCKETS - 1 && (latency_us >> i) != 0) {
+        i++;
+    }
+    hist->bucket[i]++;
+    hist->count++;
+    if (latency_us > hist->max_us) {
+        hist->max_us = latency_us;
+    }
+}
+
+/**
+ * Upper bound, in microseconds, of the bucket holding the given
+ * fraction of the recorded latencies.
+ */
+static uint32_t latency_percentile(const LineLatencyHistogram* hist, double fraction)
+{
+    uint32_t seen = 0;
+
+    for (int i = 0; i < LINE_LATENCY_BUCKETS; i++) {
+        seen += hist->bucket[i];
+        if (seen >= fraction * hist->count) {
+            return 1u << i;
+        }
+    }
+    return 1u << (LINE_LATENCY_BUCKETS - 1);
+}
+
+/**
+ * pigpio alert callback for a line sensor pin.
+ *
+ * Runs on the pigpio alert thread, which is the only producer for the
+ * event ring. Each transition is queued with the tick pigpio sampled
+ * it at, and the waiting thread is woken once per batch of changes.
+ * Unless the waiter votes on the pattern, it is published from here.
+ */
+static void line_edge_alert(int gpio, int level, uint32_t tick, void* userdata)
+{
+    LineEdgeArgs* args = (LineEdgeArgs*)userdata;
+    uint32_t mask, head, now_tick;
+    int sensor;
+
+    /* Watchdog timeouts do not change the level */
+    if (level == PI_TIMEOUT || gpio < 0 || gpio >= 32 || args->sensor_of_pin[gpio] < 0) {
+        return;
+    }
+    sensor = args->sensor_of_pin[gpio];
+    mask = level ? args->alert_mask | (1u << sensor) : args->alert_mask & ~(1u << sensor);
+    if (mask == args->alert_mask) {
+        return;
+    }
+    args->alert_mask = mask;
+    args->p_sensor_vals[sensor] = (uint8_t)level;
+    now_tick = gpioTick();
+    record_latency(&args->callback_latency, (uint32_t)Timing_TickDiff(now_tick, tick));
+    if (args->filter.window == 1) {
+        publish_line_state(mask, Timing_TickToNs(tick, now_tick, Timing_NowNs()));
+    }
+
+    head = atomic_load_explicit(&args->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&args->tail, memory_order_acquire) >= LINE_EDGE_RING_LEN) {
+        atomic_fetch_add_explicit(&args->dropped, 1, memory_order_relaxed);
+    }
+    else {
+        args->ring[head & (LINE_EDGE_RING_LEN - 1)] = (LineEdge){ tick, (uint8_t)sensor, (uint8_t)level };
+        atomic_store_explicit(&args->head, head + 1, memory_order_release);
+    }
+
+    if (!atomic_exchange(&args->pending, true)) {
+        sem_post(&args->changed);
+    }
+}
+
+/**
+ * Start reporting line sensor transitions through pigpio alerts,
+ * instead of polling the sensors from a thread. The per-sensor values
+ * are updated on every transition. With a filter_window_us the pattern
+ * returned is the majority vote over that window, as the sampler would
+ * give. Returns 0 on success.
+ */
+int start_line_edges(LineEdgeArgs* args, const uint8_t pins[], uint8_t num_sensors,
+    volatile uint8_t* p_sensor_vals, uint32_t filter_window_us)
+{
+    if (num_sensors > MAX_LINE_SENSORS) {
+        num_sensors = MAX_LINE_SENSORS;
+    }
+    memcpy(args->pins, pins, num_sensors);
+    args->num_sensors = num_sensors;
+    args->p_sensor_vals = p_sensor_vals;
+    memset(args->sensor_of_pin, -1, sizeof(args->sensor_of_pin));
+    for (uint8_t i = 0; i < num_sensors; i++) {
+        args->sensor_of_pin[pins[i] & 31] = (int8_t)i;
+    }
+
+    atomic_init(&args->head, 0);
+    atomic_init(&args->tail, 0);
+    atomic_init(&args->dropped, 0);
+    atomic_init(&args->pending, false);
+    args->resynced_dropped = 0;
+    args->changes = 0;
+    memset(&args->callback_latency, 0, sizeof(args->callback_latency));
+    memset(&args->decision_latency, 0, sizeof(args->decision_latency));
+    if (sem_init(&args->changed, 0, 0) != 0) {
+        return -1;
+    }
+
+    /* Start from the current pattern; alerts only report changes */
+    args->alert_mask = line_mask(pins, num_sensors, gpioRead_Bits_0_31());
+    args->sample.mask = args->alert_mask;
+    args->sample.raw_mask = args->alert_mask;
+    args->sample.stamp_ns = Timing_NowNs();
+    args->sample.seq = 1;
+    for (uint8_t i = 0; i < num_sensors; i++) {
+        p_sensor_vals[i] = (args->alert_mask >> i) & 1u;
+    }
+    args->edge_mask = args->alert_mask;
+    line_filter_init(&args->filter, filter_window_us, LINE_SAMPLE_PERIOD_US);
+    args->voted_mask = line_filter_update(&args->filter, args->alert_mask);
+    args->vote_tick = gpioTick();
+    args->voted_tick = args->vote_tick;
+    args->overridden = 0;
+    publish_line_state(args->alert_mask, args->sample.stamp_ns);
+
+    for (uint8_t i = 0; i < num_sensors; i++) {
+        if (gpioSetAlertFuncEx(pins[i], line_edge_alert, args) != 0) {
+            stop_line_edges(args);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Stop the line sensor alerts. The semaphore is left alone, since an
+ * alert already in progress may still post it.
+ */
+void stop_line_edges(LineEdgeArgs* args)
+{
+    for (uint8_t i = 0; i < args->num_sensors; i++) {
+        gpioSetAlertFuncEx(args->pins[i], NULL, NULL);
+    }
+}
+
+/**
+ * Vote on the pattern the transitions give at every reading the sampler
+ * would have taken up to tick. While the pattern is steady only the
+ * last window readings can change the vote, so any before those are
+ * skipped. A transition which arrives after readings past its tick
+ * have been voted on counts from the next reading.
+ */
+static void vote_line_edges(LineEdgeArgs* args, uint32_t tick)
+{
+    int32_t readings = Timing_TickDiff(tick, args->vote_tick) / LINE_SAMPLE_PERIOD_US;
+    uint32_t mask;
+
+    if (readings <= 0) {
+        return;
+    }
+    if (readings > args->filter.window) {
+        args->vote_tick += (uint32_t)(readings - args->filter.window) * LINE_SAMPLE_PERIOD_US;
+        readings = args->filter.window;
+    }
+    for (int32_t i = 0; i < readings; i++) {
+        args->vote_tick += LINE_SAMPLE_PERIOD_US;
+        mask = line_filter_update(&args->filter, args->edge_mask);
+        if (mask != args->edge_mask) {
+            args->overridden++;
+        }
+        if (mask != args->voted_mask) {
+            args->voted_mask = mask;
+            args->voted_tick = args->vote_tick;
+        }
+    }
+}
+
+/**
+ * Wait until the line pattern changes, or for at most timeout_us.
+ * 
+ * Queued transitions are applied in order to rebuild the pattern, and
+ * the sample is stamped with the time of the last transition rather
+ * than the time this thread woke up. When filtering, the pattern is
+ * voted on as it stood at each sampling instant, and stamped with the
+ * reading which changed the vote; while the vote lags the pins the
+ * thread wakes for every reading. Returns true if the pattern is
+ * different from the one returned by the previous call.
+ */
+bool wait_line_change(LineEdgeArgs* args, LineSample* sample, uint32_t timeout_us)
+{
+    const bool filtering = args->filter.window > 1;
+    uint64_t deadline_ns = Timing_Deadline(timeout_us * TIMING_NS_PER_US);
+    uint64_t wake_ns;
+    struct timespec deadline;
+    uint32_t head, tail, mask, now_tick, last_tick, dropped;
+    bool changed;
+
+    do {
+        wake_ns = deadline_ns;
+        if (filtering && args->voted_mask != args->edge_mask) {
+            uint64_t reading_ns = Timing_Deadline(LINE_SAMPLE_PERIOD_US * TIMING_NS_PER_US);
+
+            if (reading_ns < wake_ns) {
+                wake_ns = reading_ns;
+            }
+        }
+        Timing_RealtimeDeadline(wake_ns, &deadline);
+        while (sem_timedwait(&args->changed, &deadline) != 0 && errno == EINTR) {
+            /* Interrupted by a signal, keep waiting */
+        }
+        atomic_store(&args->pending, false);
+
+        now_tick = gpioTick();
+        last_tick = now_tick;
+        head = atomic_load_explicit(&args->head, memory_order_acquire);
+        tail = atomic_load_explicit(&args->tail, memory_order_relaxed);
+        for (; tail != head; tail++) {
+            const LineEdge* edge = &args->ring[tail & (LINE_EDGE_RING_LEN - 1)];
+
+            last_tick = edge->tick;
+            record_latency(&args->decision_latency, (uint32_t)Timing_TickDiff(now_tick, last_tick));
+            if (filtering) {
+                vote_line_edges(args, last_tick);
+            }
+            if (edge->level) {
+                args->edge_mask |= 1u << edge->sensor;
+            }
+            else {
+                args->edge_mask &= ~(1u << edge->sensor);
+            }
+        }
+        atomic_store_explicit(&args->tail, tail, memory_order_release);
+
+        /* Transitions were lost, so read the pattern straight from the pins */
+        dropped = atomic_load_explicit(&args->dropped, memory_order_relaxed);
+        if (dropped != args->resynced_dropped) {
+            args->resynced_dropped = dropped;
+            args->edge_mask = line_mask(args->pins, args->num_sensors, gpioRead_Bits_0_31());
+            last_tick = now_tick;
+        }
+
+        if (filtering) {
+            vote_line_edges(args, now_tick);
+            mask = args->voted_mask;
+            last_tick = args->voted_tick;
+        }
+        else {
+            mask = args->edge_mask;
+        }
+        changed = mask != args->sample.mask;
+    } while (!changed && !Timing_Expired(deadline_ns));
+
+    if (changed) {
+        args->sample.mask = mask;
+        args->sample.raw_mask = args->edge_mask;
+        args->sample.stamp_ns = Timing_TickToNs(last_tick, now_tick, Timing_NowNs());
+        args->sample.seq++;
+        args->changes++;
+        if (filtering) {
+            publish_line_state(mask, args->sample.stamp_ns);
+        }
+    }
+    *sample = args->sample;
+    return changed;
+}
+
+static void print_latency(const char* name, const LineLatencyHistogram* hist)
+{
+    if (hist->count == 0) {
+        return;
+    }
+    printf("Line edges: %s latency p50 < %u us, p99 < %u us, max %u us\n", name,
+        latency_percentile(hist, 0.5), latency_percentile(hist, 0.99), hist->max_us);
+    printf("Line edges:  ");
+    for (int i = 0; i < LINE_LATENCY_BUCKETS; i++) {
+        if (hist->bucket[i] != 0) {
+            printf(" %s%u us: %u", i == LINE_LATENCY_BUCKETS - 1 ? ">=" : "<",
+                i == LINE_LATENCY_BUCKETS - 1 ? 1u << (i - 1) : 1u << i, hist->bucket[i]);
+        }
+    }
+    printf("\n");
+}
+
+/**
+ * Print the transition counts and latency histograms. The callback
+ * latency is from pigpio sampling a transition to the alert running,
+ * and the decision latency is from the transition to the waiting
+ * thread picking it up.
+ */
+void print_line_edge_stats(LineEdgeArgs* args)
+{
+    printf("Line edges: %u transitions, %u pattern changes handled, %u dropped\n",
+        args->callback_latency.count, args->changes, atomic_load(&args->dropped));
+    print_latency("callback", &args->callback_latency);
+    print_latency("decision", &args->decision_latency);
+    if (args->filter.window > 1) {
+        printf("Line edges: majority of %u readings, %u readings changed by the filter\n",
+            args->filter.window, args->overridden);
+    }
+}
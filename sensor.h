@@ -19,23 +19,152 @@
 #define _SENSOR_H
 
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>  /* uint8_t */
 #include <pthread.h>
+#include <semaphore.h>
 
 
 #define HIGH    1
 #define LOW     0
 
+#define MAX_LINE_SENSORS        8
+#define LINE_SAMPLE_PERIOD_US   200     /* 5 kHz for the whole sensor bank */
+
+/* Line sensor filtering. pigpio's glitch filter drops pulses shorter
+ * than LINE_GLITCH_FILTER_US from the edge alerts, and both the sampler
+ * and the edge waiter take a majority vote over the readings in
+ * LINE_FILTER_WINDOW_US. */
+#define LINE_GLITCH_FILTER_US   100
+#define LINE_FILTER_WINDOW_US   1000
+#define LINE_FILTER_MAX_WINDOW  63      /* Samples */
+#define LINE_FILTER_COUNT_BITS  6       /* Bits needed to count to LINE_FILTER_MAX_WINDOW */
+
+#define MAX_SONARS              4       /* Sonar slots in the sensor state */
+
+#define LINE_EDGE_RING_LEN      256     /* Transitions buffered, power of two */
+#define LINE_LATENCY_BUCKETS    16      /* Bucket i counts latencies below 2^i us */
+
+
+/* One reading of every line sensor */
+typedef struct {
+    uint32_t mask;              /* Bit i is set when sensor i reads HIGH */
+    uint32_t raw_mask;          /* The reading before filtering */
+    uint64_t stamp_ns;          /* Monotonic time of the reading */
+    uint32_t seq;               /* Reading number */
+} LineSample;
+
+/* Sliding-window majority vote over all of the line sensors at once.
+ * The per-sensor vote counts are stored bit-sliced: bit i of count[k]
+ * is bit k of sensor i's count, so an update costs a few word-wide
+ * operations however many sensors there are. */
+typedef struct {
+    uint32_t history[LINE_FILTER_MAX_WINDOW];
+    uint32_t count[LINE_FILTER_COUNT_BITS];
+    uint8_t window;             /* Readings in the window, always odd */
+    uint8_t next;               /* Index of the oldest reading */
+    uint8_t threshold;          /* Votes needed to read HIGH */
+    bool primed;
+} LineMajorityFilter;
 
 typedef struct {
-    uint8_t* p_sensor_val;
-    uint8_t gpio_pin;
+    uint8_t pins[MAX_LINE_SENSORS];     /* GPIO pin of each sensor (0 ~ 31) */
+    uint8_t num_sensors;
+    volatile uint8_t* p_sensor_vals;    /* Also updated, one value per sensor */
+    LineMajorityFilter filter;
+    uint32_t overridden;                /* Readings changed by the filter */
     bool* p_terminate;
-} SensorArgs;
 
+    LineSample sample;                  /* Latest reading, for the stats */
+
+    /* Filled in when the sampler exits */
+    uint64_t cpu_ns;                    /* CPU time used by the sampler */
+    uint64_t wall_ns;
+} LineSamplerArgs;
+
+
+/* One transition of a line sensor, as reported by a pigpio alert */
+typedef struct {
+    uint32_t tick;              /* pigpio tick of the transition, in microseconds */
+    uint8_t sensor;             /* Index of the sensor */
+    uint8_t level;
+} LineEdge;
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t bucket[LINE_LATENCY_BUCKETS];
+} LineLatencyHistogram;
+
+typedef struct {
+    uint8_t pins[MAX_LINE_SENSORS];     /* GPIO pin of each sensor (0 ~ 31) */
+    uint8_t num_sensors;
+    volatile uint8_t* p_sensor_vals;    /* Updated on every transition */
+    int8_t sensor_of_pin[32];           /* Sensor index of each GPIO, or -1 */
+
+    /* Only written by the pigpio alert thread */
+    uint32_t alert_mask;
+    atomic_uint head;
+    atomic_uint dropped;                /* Transitions lost to a full ring */
+    atomic_bool pending;                /* A wakeup has been posted */
+    LineLatencyHistogram callback_latency;  /* Transition to alert callback */
+
+    /* Only written by the thread waiting for changes */
+    atomic_uint tail;
+    uint32_t resynced_dropped;
+    LineSample sample;
+    uint32_t changes;                   /* Pattern changes returned */
+    LineLatencyHistogram decision_latency;  /* Transition to waiter running */
+    uint32_t edge_mask;                 /* Pattern rebuilt from the transitions */
+    LineMajorityFilter filter;
+    uint32_t vote_tick;                 /* Tick of the last reading voted on */
+    uint32_t voted_mask;                /* Output of the vote */
+    uint32_t voted_tick;                /* Tick of the reading which changed it */
+    uint32_t overridden;                /* Readings changed by the filter */
+
+    LineEdge ring[LINE_EDGE_RING_LEN];
+    sem_t changed;
+} LineEdgeArgs;
+
+
+/* Consistent copy of the latest state of every sensor. Each field
+ * group carries the monotonic time it was last updated, or 0 if it
+ * never has been. */
+typedef struct {
+    uint32_t seq;                       /* Updates published so far */
+    uint64_t taken_ns;                  /* When the snapshot was taken */
+
+    uint32_t line_mask;                 /* Filtered line sensor bits */
+    uint64_t line_stamp_ns;
+
+    float sonar_cm[MAX_SONARS];         /* Filtered range, 0 while nothing is tracked */
+    float sonar_var_cm2[MAX_SONARS];    /* Variance of the filtered range */
+    float sonar_closing_cm_s[MAX_SONARS];   /* Speed the object is approaching at */
+    uint64_t sonar_stamp_ns[MAX_SONARS];    /* Time of the latest estimate */
+} SensorSnapshot;
+
+
+void publish_line_state(uint32_t mask, uint64_t stamp_ns);
+void publish_sonar_range(uint8_t sonar, float distance_cm, float var_cm2, float closing_cm_s,
+    uint64_t stamp_ns);
+void get_sensor_snapshot(SensorSnapshot* snapshot);
+uint32_t sensor_age_ms(const SensorSnapshot* snapshot, uint64_t stamp_ns);
+
+void line_filter_init(LineMajorityFilter* filter, uint32_t window_us, uint32_t period_us);
+uint32_t line_filter_update(LineMajorityFilter* filter, uint32_t mask);
+int set_line_glitch_filter(const uint8_t pins[], uint8_t num_sensors, uint32_t steady_us);
+
+void init_LineSamplerArgs(LineSamplerArgs* args, const uint8_t pins[], uint8_t num_sensors,
+    volatile uint8_t* p_sensor_vals, uint32_t filter_window_us);
+void* sample_line_sensors(LineSamplerArgs* args);
+void print_line_sampler_stats(LineSamplerArgs* args);
 
-void read_sensor(SensorArgs* args);
+int start_line_edges(LineEdgeArgs* args, const uint8_t pins[], uint8_t num_sensors,
+    volatile uint8_t* p_sensor_vals, uint32_t filter_window_us);
+void stop_line_edges(LineEdgeArgs* args);
+bool wait_line_change(LineEdgeArgs* args, LineSample* sample, uint32_t timeout_us);
+void print_line_edge_stats(LineEdgeArgs* args);
 
 
 #endif  /* _SENSOR_H */
@@ -17,17 +17,67 @@
 
 
 #include <math.h>   /* fabs() */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pigpio.h>
 #include "sonar.h"
+#include "Odometry.h"
+#include "Timing.h"
 
-void init_SonarArgs(SonarArgs* args, uint8_t pin_trig, uint8_t pin_echo)
+void init_SonarArgs(SonarArgs* args, uint8_t sonar_id, uint8_t pin_trig, uint8_t pin_echo)
 {
-    args->distance_cm = 0.0f;
-    args->confidence = 100;
+    sonar_filter_init(&args->filter, SONAR_MAX_DISTANCE_CM);
+    args->sonar_id = sonar_id;
+    args->scheduler = NULL;
+    set_sonar_range(args, SONAR_MAX_DISTANCE_CM);
+    args->facing_forward = false;
+    args->next_ping_ns = 0;
+    atomic_init(&args->armed, false);
+    atomic_init(&args->echo_rising, false);
+    atomic_init(&args->late_edges, 0);
+    atomic_init(&args->overheard, false);
+    args->echo_rise_tick = 0;
+    args->echo_start_tick = 0;
+    args->echo_us = 0;
+    memset(&args->stats, 0, sizeof(args->stats));
     args->pin_trig = pin_trig;
     args->pin_echo = pin_echo;
     args->p_terminate = NULL;
 }
 
+/**
+ * Set the furthest range a sonar listens to. The echo window closes
+ * once an echo from that range would have returned, so a sensor which
+ * only needs to see nearby objects can be pinged much more often.
+ * Must be called before the scheduler starts.
+ */
+void set_sonar_range(SonarArgs* args, float max_range_cm)
+{
+    const float min_range_cm = SONAR_MIN_DISTANCE_M * 100.0f;
+
+    if (max_range_cm < min_range_cm) {
+        max_range_cm = min_range_cm;
+    }
+    if (max_range_cm > SONAR_MAX_DISTANCE_CM) {
+        max_range_cm = SONAR_MAX_DISTANCE_CM;
+    }
+    args->max_range_cm = max_range_cm;
+    args->echo_gate_us = (uint32_t)(SONAR_ECHO_US(max_range_cm) + SONAR_ECHO_MARGIN_US);
+    args->filter.max_range_cm = max_range_cm;
+}
+
+/**
+ * Fastest a sonar could be pinged if it were the only one: one trigger
+ * and full echo window, then the settle time, per ping.
+ */
+float sonar_max_ping_hz(const SonarArgs* args)
+{
+    return US_PER_S / (SONAR_TRIGGER_US + args->echo_gate_us + SONAR_SETTLE_US);
+}
+
 /**
  * Calculate a distance in meters based on elapsed time in nanoseconds.
  *
@@ -54,134 +104,616 @@ float distance_cm(time_t time_ns)
     return distance_m(time_ns) * 100.0f;
 }
 
+void sonar_filter_init(SonarRangeFilter* filter, float max_range_cm)
+{
+    memset(filter, 0, sizeof(*filter));
+    filter->max_range_cm = max_range_cm;
+}
+
 /**
- * Increment confidence, not to exceed CONFIDENCE_MAX
+ * Median of the ranges in the window. With an even number of ranges
+ * the nearer of the middle two is used, erring towards an obstacle.
  */
-static void increment_confidence(SonarArgs* args)
+static float window_median(const SonarRangeFilter* filter)
 {
-    if (args->confidence < SONAR_CONFIDENCE_MAX) { 
-        ++args->confidence; 
+    float sorted[SONAR_MEDIAN_WINDOW];
+    uint8_t n = filter->window_len;
+
+    for (uint8_t i = 0; i < n; i++) {
+        float range = filter->window[i];
+        uint8_t j = i;
+
+        while (j > 0 && sorted[j - 1] > range) {
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = range;
     }
+    return sorted[(n - 1) / 2];
 }
 
 /**
- * Decrement confidence based on a delta value.
- * The confidence level will be decreased by delta,
- * or will hit a floor of 0.
+ * Start a track at the given range, not yet moving. The range variance
+ * starts above SONAR_TRUST_VAR_CM2, so one echo is never trusted alone.
  */
-static void decrement_confidence(SonarArgs* args, int delta)
+static void start_track(SonarRangeFilter* filter, float range_cm, uint64_t stamp_ns)
 {
-    if (args->confidence < (int)delta) {
-        args->confidence = 0;
-    } 
-    else {
-        args->confidence -= (int) delta;
+    filter->tracking = true;
+    filter->range_cm = range_cm;
+    filter->rate_cm_s = 0.0f;
+    filter->cov[0][0] = 2.0f * SONAR_TRUST_VAR_CM2;
+    filter->cov[0][1] = 0.0f;
+    filter->cov[1][0] = 0.0f;
+    filter->cov[1][1] = SONAR_INIT_RATE_CM_S * SONAR_INIT_RATE_CM_S;
+    filter->stamp_ns = stamp_ns;
+    filter->dropouts = 0;
+    filter->gated = false;
+    filter->restarts++;
+}
+
+/**
+ * Move the track forward to stamp_ns, assuming a constant range rate
+ * disturbed by random acceleration of SONAR_ACCEL_CM_S2.
+ */
+static void predict_track(SonarRangeFilter* filter, uint64_t stamp_ns)
+{
+    const float q = SONAR_ACCEL_CM_S2 * SONAR_ACCEL_CM_S2;
+    float dt = (stamp_ns - filter->stamp_ns) / 1e9f;
+    float (*P)[2] = filter->cov;
+    float p00, p01, p11;
+
+    if (stamp_ns <= filter->stamp_ns) {
+        return;
     }
+    /* P = F P F' + Q, with F = [1 dt; 0 1] */
+    p00 = P[0][0] + dt * (P[0][1] + P[1][0]) + dt * dt * P[1][1] + q * dt * dt * dt * dt / 4.0f;
+    p01 = P[0][1] + dt * P[1][1] + q * dt * dt * dt / 2.0f;
+    p11 = P[1][1] + q * dt * dt;
+    P[0][0] = p00;
+    P[0][1] = p01;
+    P[1][0] = p01;
+    P[1][1] = p11;
+    filter->range_cm += filter->rate_cm_s * dt;
+    filter->stamp_ns = stamp_ns;
 }
 
-/*
- * Thread routine to monitor readings from the HC-SR04 sonar module.
- * The thread is polled at a rate of 20hz. The validity of the reading
- * can be determined by the confidence level.
+/**
+ * Update a range filter with the result of one ping.
  *
- * The delta between consecutive readings is used to determine a 
- * confidence level. If the delta is low, the confidence will increase.
- * If the delta is high, the confidence is decreased by the amount of
- * the delta. 
+ * Each echo goes through a sliding median, so a single bad echo never
+ * reaches the Kalman filter. The median then corrects the predicted
+ * range and range rate. A median too far from the prediction to be the
+ * same object is set aside, and restarts the track if the next median
+ * agrees with it.
  *
- * To prevent stalling due to read faults, a timeout will occur if the
- * time between trigger and echo is too long. This will set an invalid
- * reading flag which decreases the confidence level by the number of 
- * consecutive invalid readings. 
+ * A ping without an echo only moves the prediction forward, which
+ * widens its variance. The track is dropped after SONAR_DROPOUT_LIMIT
+ * such pings, or at once if the object is predicted out of range.
  */
-void* watch_sonar(SonarArgs* args)
+void sonar_filter_update(SonarRangeFilter* filter, bool valid_reading, float range_cm, uint64_t stamp_ns)
 {
-    float distance = 0.0f; 
+    float (*P)[2] = filter->cov;
+    float innovation, s, k0, k1, p00, p01;
 
-    struct timespec start_time;     /* Time when trigger signal was sent */
-    struct timespec end_time;       /* Time when echo signal was received */
-    time_t time_elapsed_ns = 0;     /* Time spent waiting for echo signal */
+    if (!valid_reading) {
+        if (!filter->tracking) {
+            return;
+        }
+        predict_track(filter, stamp_ns);
+        if (++filter->dropouts >= SONAR_DROPOUT_LIMIT
+            || filter->range_cm > filter->max_range_cm || filter->range_cm < 0.0f) {
+            filter->tracking = false;
+            filter->window_len = 0;
+            filter->window_next = 0;
+            filter->lost++;
+        }
+        return;
+    }
+
+    filter->window[filter->window_next] = range_cm;
+    filter->window_next = (filter->window_next + 1) % SONAR_MEDIAN_WINDOW;
+    if (filter->window_len < SONAR_MEDIAN_WINDOW) {
+        filter->window_len++;
+    }
+    range_cm = window_median(filter);
+
+    if (!filter->tracking) {
+        start_track(filter, range_cm, stamp_ns);
+        return;
+    }
+    predict_track(filter, stamp_ns);
+    filter->dropouts = 0;
+
+    innovation = range_cm - filter->range_cm;
+    s = P[0][0] + SONAR_RANGE_VAR_CM2;
+    if (innovation * innovation > SONAR_GATE_SIGMA * SONAR_GATE_SIGMA * s) {
+        innovation = range_cm - filter->gated_cm;
+        if (filter->gated
+            && innovation * innovation <= SONAR_GATE_SIGMA * SONAR_GATE_SIGMA * 2.0f * SONAR_RANGE_VAR_CM2) {
+            start_track(filter, range_cm, stamp_ns);
+        }
+        else {
+            filter->gated = true;
+            filter->gated_cm = range_cm;
+        }
+        return;
+    }
+    filter->gated = false;
+    k0 = P[0][0] / s;
+    k1 = P[1][0] / s;
+    filter->range_cm += k0 * innovation;
+    filter->rate_cm_s += k1 * innovation;
+
+    /* P = (I - K H) P, with H = [1 0] */
+    p00 = P[0][0];
+    p01 = P[0][1];
+    P[0][0] = (1.0f - k0) * p00;
+    P[0][1] = (1.0f - k0) * p01;
+    P[1][0] = P[0][1];
+    P[1][1] -= k1 * p01;
+}
+
+/**
+ * Flag the window of whichever other sonar is listening, after an echo
+ * of args ended outside its own window.
+ */
+static void mark_overheard(const SonarArgs* args)
+{
+    SonarSchedulerArgs* sched = args->scheduler;
+
+    if (sched == NULL) {
+        return;
+    }
+    for (uint8_t i = 0; i < sched->num_sonars; i++) {
+        SonarArgs* other = sched->sonars[i];
+
+        if (other != args && atomic_load(&other->armed)) {
+            atomic_store(&other->overheard, true);
+        }
+    }
+}
+
+/**
+ * pigpio alert callback for an echo pin. The rising edge starts the
+ * echo and the falling edge completes it; both carry the tick pigpio
+ * sampled the level at, so the width does not depend on how quickly
+ * either callback runs.
+ */
+static void sonar_echo_alert(int gpio, int level, uint32_t tick, void* userdata)
+{
+    SonarArgs* args = (SonarArgs*)userdata;
+
+    /* The echo pin only answers this sensor's own trigger, so an edge
+     * outside its window is the end of an echo from beyond max range,
+     * which the window gave up on. Its burst was still in flight, so
+     * whichever sonar is listening now may have heard it. */
+    if (!atomic_load(&args->armed)) {
+        if (level != PI_TIMEOUT) {
+            atomic_fetch_add(&args->late_edges, 1);
+            mark_overheard(args);
+        }
+        atomic_store(&args->echo_rising, false);
+        return;
+    }
+    if (level == 1) {
+        args->echo_rise_tick = tick;
+        atomic_store(&args->echo_rising, true);
+    }
+    else if (level == 0 && atomic_exchange(&args->echo_rising, false)) {
+        args->echo_start_tick = args->echo_rise_tick;
+        args->echo_us = (uint32_t)Timing_TickDiff(tick, args->echo_rise_tick);
+        sem_post(&args->echo_done);
+    }
+}
+
+/**
+ * Send a trigger pulse and wait for the echo from the pigpio alerts.
+ * The thread sleeps until the falling edge arrives or the echo would
+ * be out of range, so the window closes as soon as the echo is back.
+ * Returns false if there was no valid echo.
+ */
+static bool measure_echo_alert(SonarArgs* args, time_t* time_elapsed_ns)
+{
+    struct timespec deadline;
+    uint32_t trigger_tick;
+    bool echoed = true;
+
+    /* Discard an echo which finished after the last ping gave up on it */
+    while (sem_trywait(&args->echo_done) == 0) {
+    }
+    atomic_store(&args->echo_rising, false);
+    atomic_store(&args->overheard, false);
+    atomic_store(&args->armed, true);
+
+    trigger_tick = gpioTick();
+    if (gpioTrigger(args->pin_trig, SONAR_TRIGGER_US, HIGH) != 0) {
+        atomic_store(&args->armed, false);
+        return false;
+    }
+
+    Timing_RealtimeDeadline(Timing_Deadline(args->echo_gate_us * TIMING_NS_PER_US), &deadline);
+    while (sem_timedwait(&args->echo_done, &deadline) != 0) {
+        if (errno != EINTR) {
+            echoed = false;
+            break;
+        }
+    }
+    atomic_store(&args->armed, false);
+    if (!echoed) {
+        return false;
+    }
+
+    /* The echo must have started after this trigger, or it is the
+     * late end of the last ping's echo */
+    if (Timing_TickBefore(args->echo_start_tick, trigger_tick)) {
+        args->stats.late_echoes++;
+        return false;
+    }
+    if (atomic_exchange(&args->overheard, false)) {
+        args->stats.crosstalk++;
+        return false;
+    }
+    if (args->echo_us > SONAR_ECHO_US(args->max_range_cm)) {
+        return false;
+    }
+    *time_elapsed_ns = (time_t)args->echo_us * 1000;
+    return true;
+}
+
+#if !SONAR_EDGE_DRIVEN
+/**
+ * Send a trigger pulse and time the echo by polling the echo pin.
+ * Keeps a core busy for the whole measurement.
+ */
+static bool measure_echo_polled(SonarArgs* args, time_t* time_elapsed_ns)
+{
+    uint64_t start_ns;              /* Time when the echo pin went high */
 
     /* Create a timer to break out of infinite loops caused by bad readings */
-    struct timespec timeout;        
-    struct timespec now;       
-    time_t timeout_ns = (time_t)SONAR_TIMEOUT_NS;
-
-    /* Delta is used to determine the distance between two successive readings.
-     * If the delta between two readings exceeds the threshold, the confidence
-     * will be reduced by delta * delta_weight. Otherwise confidence is incremented. */
-    int delta = 0;              /* Distance between readings */
-    int delta_weight = 1;       /* Adjust the impact of delta in confidence reduction */
-    int delta_threshold = 5;    /* Maximum delta for confidence increase. */
-
-    uint8_t consecutive_bad_readings = 0;
-    bool valid_reading;         /* Indicates that a timeout occurred and reading failed. */
-
-    /* Continue polling the sensor until termination occurs. */
-    while (!*(args->p_terminate))
-    {
-        valid_reading = true;
-
-        /* Send a signal for 10 microseconds */
-        gpioWrite(args->pin_trig, HIGH);
-        usleep(10); /* microseconds */
-        gpioWrite(args->pin_trig, LOW);
-
-        /* Wait until the echo pin gets pulled up */
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        while (gpioRead(args->pin_echo) == 0 && valid_reading && !*(args->p_terminate)) {
-            clock_gettime(CLOCK_REALTIME, &now);
-            valid_reading = now.tv_nsec - timeout.tv_nsec < timeout_ns;
+    uint64_t deadline_ns;
+    bool valid_reading = true;
+
+    /* Send a signal for 10 microseconds */
+    gpioWrite(args->pin_trig, HIGH);
+    usleep(SONAR_TRIGGER_US); /* microseconds */
+    gpioWrite(args->pin_trig, LOW);
+
+    /* Wait until the echo pin gets pulled up */
+    deadline_ns = Timing_Deadline(args->echo_gate_us * TIMING_NS_PER_US);
+    while (gpioRead(args->pin_echo) == 0 && valid_reading && !*(args->p_terminate)) {
+        valid_reading = !Timing_Expired(deadline_ns);
+    }
+    /* Echo pin is HIGH: Start waiting to receive a signal */
+    start_ns = Timing_NowNs();
+    deadline_ns = start_ns + (uint64_t)(SONAR_ECHO_US(args->max_range_cm) * TIMING_NS_PER_US);
+    while (gpioRead(args->pin_echo) == 1 && valid_reading && !*(args->p_terminate)) {
+        valid_reading = !Timing_Expired(deadline_ns);
+    }
+    if (!valid_reading) {
+        return false;
+    }
+    /* Signal has been received and echo pin is low again. */
+    /* End timer and calculate distance based on the time elapsed */
+    *time_elapsed_ns = (time_t)(Timing_NowNs() - start_ns);
+    return true;
+}
+#endif
+
+/**
+ * Add a valid echo to the statistics. Jitter is estimated from the
+ * change between consecutive echoes, which a slowly moving target
+ * barely affects.
+ */
+static void record_echo(SonarStats* stats, time_t time_elapsed_ns)
+{
+    double echo_us = time_elapsed_ns / 1000.0;
+
+    if (stats->echoes > 0) {
+        stats->echo_diff_sq_total += (echo_us - stats->last_echo_us) * (echo_us - stats->last_echo_us);
+    }
+    stats->last_echo_us = echo_us;
+    stats->echoes++;
+    stats->echo_mean_us += (echo_us - stats->echo_mean_us) / stats->echoes;
+}
+
+/*
+ * Pass the result of one ping through the range filter of a sonar, and
+ * publish the estimate to the shared sensor state. While nothing is
+ * tracked the range is published as 0, with an infinite variance.
+ */
+static void update_range(SonarArgs* args, bool valid_reading, time_t time_elapsed_ns)
+{
+    const SonarRangeFilter* filter = &args->filter;
+    uint64_t now_ns = Timing_NowNs();
+
+    args->stats.pings++;
+    if (valid_reading) {
+        record_echo(&args->stats, time_elapsed_ns);
+    }
+    sonar_filter_update(&args->filter, valid_reading, distance_cm(time_elapsed_ns), now_ns);
+
+    if (filter->tracking) {
+        publish_sonar_range(args->sonar_id, filter->range_cm, filter->cov[0][0],
+            -filter->rate_cm_s, now_ns);
+    }
+    else {
+        publish_sonar_range(args->sonar_id, 0.0f, INFINITY, 0.0f, now_ns);
+    }
+}
+
+void init_SonarSchedulerArgs(SonarSchedulerArgs* sched, SonarArgs* sonars[], uint8_t num_sonars)
+{
+    if (num_sonars > MAX_SONARS) {
+        num_sonars = MAX_SONARS;
+    }
+    memset(sched->sonars, 0, sizeof(sched->sonars));
+    for (uint8_t i = 0; i < num_sonars; i++) {
+        sched->sonars[i] = sonars[i];
+        sonars[i]->scheduler = sched;
+    }
+    sched->num_sonars = num_sonars;
+    sched->p_terminate = NULL;
+    atomic_init(&sched->priority, num_sonars > 0 ? sonars[0]->sonar_id : 0);
+    sched->pings = 0;
+    sched->listen_ns = 0;
+    sched->cpu_ns = 0;
+    sched->wall_ns = 0;
+}
+
+/*
+ * Give a sonar the largest share of the pings, e.g. the sensor facing
+ * the way the car is about to move. Takes effect at the next ping.
+ */
+void prioritize_sonar(SonarArgs* args)
+{
+    if (args->scheduler != NULL) {
+        atomic_store(&args->scheduler->priority, args->sonar_id);
+    }
+}
+
+/*
+ * Choose the next sonar to ping among those which are due, by smooth
+ * weighted round robin: each due sonar earns its weight in credit, the
+ * one with the most credit is pinged and pays back the total. When
+ * several are due, the priority sonar gets SONAR_PRIORITY_WEIGHT pings
+ * for each ping of any other, and the pings of each are spread out 
+ * evenly. Returns -1 if no sonar is due yet.
+ */
+static int next_sonar(SonarSchedulerArgs* sched, int credit[MAX_SONARS], uint64_t now_ns)
+{
+    unsigned priority = atomic_load(&sched->priority);
+    int total = 0;
+    int best = -1;
+
+    for (uint8_t i = 0; i < sched->num_sonars; i++) {
+        int weight = sched->sonars[i]->sonar_id == priority ? SONAR_PRIORITY_WEIGHT : 1;
+
+        if (sched->sonars[i]->next_ping_ns > now_ns) {
+            continue;
         }
-        /* Echo pin is HIGH: Start waiting to receive a signal */
-        clock_gettime(CLOCK_REALTIME, &start_time);
-        clock_gettime(CLOCK_REALTIME, &timeout);
-        while (gpioRead(args->pin_echo) == 1 && valid_reading && !*(args->p_terminate)) {
-            clock_gettime(CLOCK_REALTIME, &now);
-            valid_reading = now.tv_nsec - timeout.tv_nsec < timeout_ns;
+        credit[i] += weight;
+        total += weight;
+        if (best < 0 || credit[i] > credit[best]) {
+            best = i;
         }
-        if (!valid_reading) 
+    }
+    if (best >= 0) {
+        credit[best] -= total;
+    }
+    return best;
+}
+
+/*
+ * Forward speed of the car from the encoders, or 0 if odometry is
+ * not available.
+ */
+static float vehicle_speed_cm_s(void)
+{
+    OdometryPose pose;
+
+    if (!Odometry_Valid() || !Odometry_GetPose(&pose)) {
+        return 0.0f;
+    }
+    return fmaxf(pose.v_cm_s, 0.0f);
+}
+
+/*
+ * Time until a sonar should be pinged again. The tracked object (or,
+ * with nothing tracked, one which could appear at the edge of the
+ * range) must get SONAR_PINGS_TO_CONTACT pings before it could reach
+ * the car at its closing speed. For a forward facing sonar, everything
+ * ahead closes at least at the speed of the car. A sonar with nothing
+ * closing on it is pinged at SONAR_PING_HZ, and none faster than its
+ * echo window allows.
+ */
+static uint64_t ping_interval_ns(const SonarArgs* args, float vehicle_cm_s)
+{
+    const SonarRangeFilter* filter = &args->filter;
+    const uint64_t max_ns = TIMING_NS_PER_S / SONAR_PING_HZ;
+    const uint64_t min_ns = (uint64_t)(TIMING_NS_PER_S / sonar_max_ping_hz(args));
+    float range_cm = filter->tracking ? filter->range_cm : args->max_range_cm;
+    float closing_cm_s = filter->tracking ? -filter->rate_cm_s : 0.0f;
+    float interval_ns;
+
+    if (args->facing_forward) {
+        closing_cm_s = fmaxf(closing_cm_s, vehicle_cm_s);
+    }
+    if (closing_cm_s <= 0.0f) {
+        return max_ns;
+    }
+    interval_ns = fmaxf(range_cm, 0.0f) / closing_cm_s / SONAR_PINGS_TO_CONTACT * (float)TIMING_NS_PER_S;
+    if (interval_ns >= max_ns) {
+        return max_ns;
+    }
+    if (interval_ns <= min_ns) {
+        return min_ns;
+    }
+    return (uint64_t)interval_ns;
+}
+
+/*
+ * Thread routine which owns the triggers of all of the HC-SR04 sonar
+ * modules. Only one sonar is pinged at a time, so the echo windows
+ * never overlap and one sensor cannot hear another's burst.
+ *
+ * Each window closes as soon as the echo is back, or once an echo
+ * from the sonar's own max range would have returned, then the 
+ * scheduler waits SONAR_SETTLE_US before the next trigger. Each sonar
+ * is pinged again after an interval which shrinks as an object gets 
+ * nearer or closes faster, so a near, fast-closing obstacle is pinged
+ * as fast as its echo window allows.
+ *
+ * With SONAR_EDGE_DRIVEN, the trigger pulse is timed by pigpio and the
+ * echo edges are timestamped by pigpio alerts, so the thread sleeps
+ * through the whole measurement instead of spinning on the echo pin.
+ *
+ * To prevent stalling due to read faults, a timeout will occur if the
+ * time between trigger and echo is too long.
+ */
+void* run_sonar_scheduler(SonarSchedulerArgs* sched)
+{
+    uint64_t start_ns = Timing_NowNs();
+    uint64_t window_ns, wake_ns;
+    uint64_t last_ping_ns[MAX_SONARS] = { 0 };
+    int credit[MAX_SONARS] = { 0 };
+    int next;
+    time_t time_elapsed_ns = 0;     /* Time spent waiting for echo signal */
+    bool valid_reading;             /* Indicates that a timeout occurred and reading failed. */
+    SonarArgs* args;
+
+#if SONAR_EDGE_DRIVEN
+    for (uint8_t i = 0; i < sched->num_sonars; i++) {
+        args = sched->sonars[i];
+        if (sem_init(&args->echo_done, 0, 0) != 0
+            || gpioSetAlertFuncEx(args->pin_echo, sonar_echo_alert, args) != 0)
         {
-            /* Don't bother calculating distance on a bad reading. */
-            if (consecutive_bad_readings < 100) {
-                ++consecutive_bad_readings;
+            fprintf(stderr, "Failed to register the sonar echo alert on pin %u\n", args->pin_echo);
+            while (i-- > 0) {
+                gpioSetAlertFuncEx(sched->sonars[i]->pin_echo, NULL, NULL);
             }
-            decrement_confidence(args, consecutive_bad_readings * delta_weight);
+            return NULL;
         }
-        else  
-        {
-            consecutive_bad_readings = 0;
-            /* Signal has been received and echo pin is low again. */
-            /* End timer and calculate distance based on the time elapsed */
-            clock_gettime(CLOCK_REALTIME, &end_time);
-            time_elapsed_ns = end_time.tv_nsec - start_time.tv_nsec;
-            distance = distance_cm(time_elapsed_ns);
-
-            /* Update confidence based on the difference between current and last reading */
-            delta = (int) fabs(distance - args->distance_cm) * delta_weight;
-            if (args->distance_cm > 0 && delta < delta_threshold) {
-                increment_confidence(args);
-            } else  {
-                decrement_confidence(args, (int)delta);
-            }
-            /* Capture the current reading if confidence is high enough */
-            if (delta < SONAR_MAX_DISTANCE_CM) {
-                args->distance_cm = distance_cm(time_elapsed_ns);
+    }
+#endif
+
+    /* Continue pinging the sensors until termination occurs. */
+    while (sched->num_sonars > 0 && !*(sched->p_terminate))
+    {
+        window_ns = Timing_NowNs();
+        next = next_sonar(sched, credit, window_ns);
+        if (next < 0) {
+            /* Sleep until the first sonar is due */
+            wake_ns = UINT64_MAX;
+            for (uint8_t i = 0; i < sched->num_sonars; i++) {
+                if (sched->sonars[i]->next_ping_ns < wake_ns) {
+                    wake_ns = sched->sonars[i]->next_ping_ns;
+                }
             }
+            Timing_SleepUntil(wake_ns);
+            continue;
+        }
+        args = sched->sonars[next];
+        if (last_ping_ns[next] != 0 && (args->stats.min_interval_ns == 0
+            || window_ns - last_ping_ns[next] < args->stats.min_interval_ns)) {
+            args->stats.min_interval_ns = window_ns - last_ping_ns[next];
         }
-        /* Delay to limit polling frequency */
-        usleep(SONAR_PING_DELAY_US);
+        last_ping_ns[next] = window_ns;
+#if SONAR_EDGE_DRIVEN
+        valid_reading = measure_echo_alert(args, &time_elapsed_ns);
+#else
+        valid_reading = measure_echo_polled(args, &time_elapsed_ns);
+#endif
+        sched->listen_ns += Timing_NowNs() - window_ns;
+        sched->pings++;
+        update_range(args, valid_reading, time_elapsed_ns);
+        args->next_ping_ns = window_ns + ping_interval_ns(args, vehicle_speed_cm_s());
+
+        Timing_SleepUntil(Timing_Deadline(SONAR_SETTLE_US * TIMING_NS_PER_US));
+    }
+
+    sched->wall_ns = Timing_NowNs() - start_ns;
+    for (uint8_t i = 0; i < sched->num_sonars; i++) {
+        args = sched->sonars[i];
+#if SONAR_EDGE_DRIVEN
+        gpioSetAlertFuncEx(args->pin_echo, NULL, NULL);
+#endif
+        args->stats.late_echoes += atomic_load(&args->late_edges);
+        args->stats.wall_ns = sched->wall_ns;
     }
+    sched->cpu_ns = Timing_ThreadCpuNs();
+    return NULL;
+}
+
+/*
+ * Check whether a sensor snapshot shows an object within range of a
+ * sonar, from a range estimate no older than max_age_ms with a variance
+ * small enough to be trusted.
+ */
+bool sonar_detects(const SensorSnapshot* snapshot, uint8_t sonar_id, float max_distance_cm,
+    uint32_t max_age_ms)
+{
+    return (sonar_id < MAX_SONARS
+        && snapshot->sonar_cm[sonar_id] > 0
+        && snapshot->sonar_cm[sonar_id] <= max_distance_cm
+        && snapshot->sonar_var_cm2[sonar_id] <= SONAR_TRUST_VAR_CM2
+        && sensor_age_ms(snapshot, snapshot->sonar_stamp_ns[sonar_id]) <= max_age_ms);
 }
 
 /* 
  * Check whether an object is currently detected within range 
- * of the sensor, with a high enough confidence level.
+ * of the sensor, from a trusted range estimate.
  */
 bool object_present(SonarArgs* args, float max_distance_cm)
 {
-    return (args->distance_cm > 0
-        && args->distance_cm <= max_distance_cm 
-        && args->confidence >= SONAR_CONFIDENCE_THRESHOLD);
+    SensorSnapshot snapshot;
+
+    get_sensor_snapshot(&snapshot);
+    return sonar_detects(&snapshot, args->sonar_id, max_distance_cm, SONAR_MAX_AGE_MS);
 }
 
+
+/*
+ * Print the echo statistics and achieved ping rate of a sonar.
+ * Only valid once the scheduler thread has exited.
+ */
+void print_sonar_stats(SonarArgs* args, const char* name)
+{
+    const SonarStats* stats = &args->stats;
+    double jitter_us = 0.0;
+
+    if (stats->wall_ns == 0) {
+        return;
+    }
+    if (stats->echoes > 1) {
+        jitter_us = sqrt(stats->echo_diff_sq_total / (stats->echoes - 1) / 2.0);
+    }
+    printf("Sonar %s: %u pings, %u echoes, mean echo %.0f us (%.1f cm), jitter %.1f us (%.2f cm)\n",
+        name, stats->pings, stats->echoes, stats->echo_mean_us, 
+        distance_cm((time_t)(stats->echo_mean_us * 1000.0)), jitter_us,
+        distance_cm((time_t)(jitter_us * 1000.0)));
+    printf("Sonar %s: %.1f pings/s achieved of %.1f theoretical max (%.0f cm range), fastest interval %.1f ms\n",
+        name, stats->pings * NS_PER_S / stats->wall_ns, sonar_max_ping_hz(args), args->max_range_cm,
+        stats->min_interval_ns / 1e6);
+    printf("Sonar %s: %u late echoes from beyond range, %u crosstalk echoes rejected\n",
+        name, stats->late_echoes, stats->crosstalk);
+    printf("Sonar %s: %u tracks started, %u lost to missed echoes\n",
+        name, args->filter.restarts, args->filter.lost);
+}
+
+/*
+ * Print the ping rate and CPU usage of the sonar scheduler.
+ * Only valid once the thread has exited. Alert callbacks run on the
+ * pigpio thread, so their (small) cost is not included.
+ */
+void print_sonar_scheduler_stats(SonarSchedulerArgs* sched)
+{
+    if (sched->wall_ns == 0) {
+        return;
+    }
+    printf("Sonar scheduler: %u pings, %.1f pings/s, echo windows open %.1f%% of the time\n",
+        sched->pings, sched->pings * NS_PER_S / sched->wall_ns,
+        100.0 * sched->listen_ns / sched->wall_ns);
+    printf("Sonar scheduler: CPU %.2f%% of one core (%s)\n",
+        100.0 * sched->cpu_ns / sched->wall_ns,
+        SONAR_EDGE_DRIVEN ? "edge alerts" : "busy-wait");
+}
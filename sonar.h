@@ -19,6 +19,7 @@
 #ifndef _SONAR_H
 #define _SONAR_H
 
+#include <semaphore.h>
 #include "sensor.h"
 
 
@@ -41,29 +42,156 @@
 #define SONAR_TIMEOUT_S SONAR_MAX_DISTANCE_M / VSOUND_M_S
 #define SONAR_TIMEOUT_NS SONAR_TIMEOUT_S * NS_PER_S
 
-/* Set a limit on how frequently the sensor is polled */
+/* Slowest rate each sensor is polled at, used to judge how old a
+ * reading may be. The scheduler pings faster when echoes are short. */
 #define SONAR_PING_HZ     20  /* Number of polls per second */
 #define SONAR_PING_DELAY_US US_PER_S / SONAR_PING_HZ
 
-#define SONAR_CONFIDENCE_MAX 100
-#define SONAR_CONFIDENCE_THRESHOLD 5
+/* Width of the echo from an object at range_cm */
+#define SONAR_ECHO_US(range_cm) ((range_cm) * 2.0 * US_PER_S / (VSOUND_M_S * 100.0))
+
+/* Extra wait for an echo, covering the delay between the trigger
+ * and the start of the echo pulse */
+#define SONAR_ECHO_MARGIN_US 1000
+
+/* Ping a sonar often enough to get this many pings before an object
+ * at its current range and closing speed could reach it */
+#define SONAR_PINGS_TO_CONTACT 20
+
+/* Quiet time between the end of one echo window and the next trigger.
+ * An echo from beyond the range of a short window may still be in
+ * flight after it; a window it overlaps is rejected as crosstalk */
+#define SONAR_SETTLE_US 10000
+
+/* Pings given to the priority sonar for each ping of another sonar */
+#define SONAR_PRIORITY_WEIGHT 3
+
+/* Range filter: a sliding median rejects single bad echoes and feeds
+ * a Kalman filter on range and range rate */
+#define SONAR_MEDIAN_WINDOW 3
+#define SONAR_RANGE_VAR_CM2 1.0f        /* Variance of the range from one echo */
+#define SONAR_ACCEL_CM_S2 200.0f        /* Std dev of the change in range rate, per second */
+#define SONAR_INIT_RATE_CM_S 100.0f     /* Std dev of the range rate of a new track */
+
+/* A median further than this many std devs from the prediction is
+ * ignored, unless the next median agrees with it, which means a new
+ * object and restarts the track */
+#define SONAR_GATE_SIGMA 4.0f
+
+/* Dropout model: pings without an echo only widen the prediction, 
+ * until this many in a row drop the track */
+#define SONAR_DROPOUT_LIMIT 3
+
+/* Largest range variance trusted to show an object. A new track
+ * starts above it, so a second echo must confirm the first. */
+#define SONAR_TRUST_VAR_CM2 4.0f
+
+/* Time the echo pulse on pigpio edge alerts (1), or busy-wait on the
+ * echo pin (0) */
+#define SONAR_EDGE_DRIVEN 1
+
+#define SONAR_TRIGGER_US 10                     /* Length of the trigger pulse */
+
+/* Longest wait for an echo to finish, for a sensor listening out to
+ * its full range */
+#define SONAR_ECHO_WAIT_US (SONAR_ECHO_US(SONAR_MAX_DISTANCE_CM) + SONAR_ECHO_MARGIN_US)
+
+/* Readings older than this are not trusted to show an object */
+#define SONAR_MAX_AGE_MS (2 * 1000 / SONAR_PING_HZ)
+
+typedef struct {
+    uint32_t pings;
+    uint32_t echoes;            /* Pings with a valid echo */
+    double echo_mean_us;
+    double last_echo_us;
+    double echo_diff_sq_total;  /* Sum of squared changes between echoes */
+    uint32_t late_echoes;       /* Echoes still going when the window closed, from beyond max range */
+    uint32_t crosstalk;         /* Echoes heard while another sonar's echo was still going */
+    uint64_t min_interval_ns;   /* Shortest time between two pings */
+    uint64_t wall_ns;           /* Time the scheduler ran, set when it exits */
+} SonarStats;
+
+typedef struct {
+    float window[SONAR_MEDIAN_WINDOW];  /* Latest raw ranges */
+    uint8_t window_len;
+    uint8_t window_next;
+
+    bool tracking;
+    float range_cm;
+    float rate_cm_s;            /* Change in range, negative while closing */
+    float cov[2][2];            /* Covariance of (range, rate) */
+    uint64_t stamp_ns;
+    uint8_t dropouts;           /* Consecutive pings without an echo */
+    bool gated;                 /* The last median was too far from the prediction */
+    float gated_cm;
+
+    uint32_t restarts;          /* Tracks started, or restarted by a jump in range */
+    uint32_t lost;              /* Tracks dropped after missed echoes */
+    float max_range_cm;         /* A track predicted beyond this is dropped */
+} SonarRangeFilter;
+
+typedef struct SonarSchedulerArgs SonarSchedulerArgs;
 
 typedef struct {
-    float distance_cm;         /* the actual distance reading */
-    int confidence;
+    SonarRangeFilter filter;
+    uint8_t sonar_id;          /* Slot in the shared sensor state */
     uint8_t pin_trig;
     uint8_t pin_echo;
     bool* p_terminate;
+    SonarSchedulerArgs* scheduler;  /* Scheduler which owns the trigger */
+
+    /* Range gating and ping rate */
+    float max_range_cm;         /* Echoes from further away are not waited for */
+    uint32_t echo_gate_us;      /* Longest wait for the echo of a ping */
+    bool facing_forward;        /* Objects ahead close at the speed of the car */
+    uint64_t next_ping_ns;      /* Earliest time for the next ping */
+
+    /* Echo timing from pigpio alerts */
+    sem_t echo_done;
+    atomic_bool armed;          /* An echo window is open for this sensor */
+    atomic_bool echo_rising;    /* The echo pin has gone high */
+    atomic_uint late_edges;     /* Echo edges seen after this sensor's window closed */
+    atomic_bool overheard;      /* Another sonar's echo ended while this window was open */
+    uint32_t echo_rise_tick;
+    uint32_t echo_start_tick;   /* Rising edge of the last complete echo */
+    uint32_t echo_us;           /* Width of the last complete echo */
+
+    SonarStats stats;
 } SonarArgs;
 
+/* One thread owns the triggers of all of the sonars and pings them
+ * one at a time, so one sensor never hears another's burst. */
+struct SonarSchedulerArgs {
+    SonarArgs* sonars[MAX_SONARS];
+    uint8_t num_sonars;
+    bool* p_terminate;
+    atomic_uint priority;       /* Sonar id which gets the most pings */
+
+    uint32_t pings;
+    uint64_t listen_ns;         /* Time spent with an echo window open */
+    uint64_t cpu_ns;            /* CPU time of the scheduler thread, set when it exits */
+    uint64_t wall_ns;
+};
 
-void init_SonarArgs(SonarArgs* args, uint8_t pin_trig, uint8_t pin_echo);
+
+void init_SonarArgs(SonarArgs* args, uint8_t sonar_id, uint8_t pin_trig, uint8_t pin_echo);
+void set_sonar_range(SonarArgs* args, float max_range_cm);
+float sonar_max_ping_hz(const SonarArgs* args);
 
 float distance_m(time_t time_ns);
 float distance_cm(time_t time_ns);
 
-void* watch_sonar(SonarArgs* args);
+void sonar_filter_init(SonarRangeFilter* filter, float max_range_cm);
+void sonar_filter_update(SonarRangeFilter* filter, bool valid_reading, float range_cm, uint64_t stamp_ns);
+
+void init_SonarSchedulerArgs(SonarSchedulerArgs* sched, SonarArgs* sonars[], uint8_t num_sonars);
+void* run_sonar_scheduler(SonarSchedulerArgs* sched);
+void prioritize_sonar(SonarArgs* args);
+bool sonar_detects(const SensorSnapshot* snapshot, uint8_t sonar_id, float max_distance_cm,
+    uint32_t max_age_ms);
 bool object_present(SonarArgs* args, float max_distance);
+void print_sonar_stats(SonarArgs* args, const char* name);
+void print_sonar_scheduler_stats(SonarSchedulerArgs* sched);
 
 
 #endif  /* _SONAR_H */
@@ -0,0 +1,72 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         bench_line_policy.c
+*
+* Description:
+*   Times the line following policy table against the original if/else
+*   chain over all 32 sensor masks, after checking that both give the
+*   same action for every mask. Run by make bench.
+******************************************************************************/
+
+#include <stdio.h>
+#include "movement.h"
+#include "Timing.h"
+
+#define BENCH_ROUNDS    1000000
+
+static const char* action_names[NUM_LINE_ACTIONS] = {
+    "HOLD", "LEFT", "RIGHT", "STRAIGHT", "LAST", "OUTER_LEFT", "OUTER_RIGHT"
+};
+
+/**
+ * Time BENCH_ROUNDS passes over every mask, returning ns per decision.
+ */
+static double time_decisions(LineAction (*decide)(uint32_t mask))
+{
+    volatile unsigned sink = 0;
+    uint64_t start = Timing_NowNs();
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (uint32_t mask = 0; mask < LINE_POLICY_SIZE; mask++) {
+            sink += decide(mask);
+        }
+    }
+    return (double)(Timing_NowNs() - start) / ((double)BENCH_ROUNDS * LINE_POLICY_SIZE);
+}
+
+int main(void)
+{
+    int mismatches = 0;
+    double table_ns, chain_ns;
+
+    for (uint32_t mask = 0; mask < LINE_POLICY_SIZE; mask++) {
+        LineAction table = line_policy_action(mask);
+        LineAction chain = follow_line_reference(mask);
+
+        if (table != chain) {
+            printf("mask %2u: table %s, if/else chain %s\n",
+                mask, action_names[table], action_names[chain]);
+            mismatches++;
+        }
+    }
+    if (mismatches > 0) {
+        printf("bench_line_policy: %d of %d masks differ\n", mismatches, LINE_POLICY_SIZE);
+        return 1;
+    }
+
+    table_ns = time_decisions(line_policy_action);
+    chain_ns = time_decisions(follow_line_reference);
+    printf("bench_line_policy: all %d masks agree\n", LINE_POLICY_SIZE);
+    printf("bench_line_policy: table %.2f ns, if/else chain %.2f ns per decision\n",
+        table_ns, chain_ns);
+    return 0;
+}
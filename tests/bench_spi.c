@@ -0,0 +1,89 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         bench_spi.c
+*
+* Description:
+*   Times LS7366R counter reads through the spidev path, linked against
+*   the spidev loopback mock so it runs off target. The time measured is
+*   the driver's own cost per read; the time on the wire at the SPI
+*   clock is added from the message length. Run by make bench.
+******************************************************************************/
+
+#include <stdio.h>
+#include "7366rDriver.h"
+#include "Timing.h"
+
+#define BENCH_READS     100000
+
+/* Bytes in one counter read: the opcode and a 4 byte count */
+#define READ_BYTES      5
+
+/**
+ * Time BENCH_READS reads of both chips, one chip at a time, returning
+ * ns per read.
+ */
+static double time_reads(void)
+{
+    volatile long long sink = 0;
+    uint64_t start = Timing_NowNs();
+
+    for (int i = 0; i < BENCH_READS; i++) {
+        sink += readLS7336RCounter64(SPI0_CE0);
+        sink += readLS7336RCounter64(SPI0_CE1);
+    }
+    return (double)(Timing_NowNs() - start) / (2.0 * BENCH_READS);
+}
+
+/**
+ * Time BENCH_READS latched reads of both chips together, returning ns
+ * per pair.
+ */
+static double time_latched(void)
+{
+    const int chips[2] = { SPI0_CE0, SPI0_CE1 };
+    LS7336R_READING readings[2];
+    unsigned long long stamp_ns, skew_ns;
+    uint64_t start = Timing_NowNs();
+
+    for (int i = 0; i < BENCH_READS; i++) {
+        readLS7336RCountersLatched(chips, 2, readings, &stamp_ns, &skew_ns);
+    }
+    return (double)(Timing_NowNs() - start) / BENCH_READS;
+}
+
+int main(void)
+{
+    LS7336R_STATS stats;
+    double wire_us = READ_BYTES * 8 * 1e6 / LS7366R_SPI_SPEED;
+    double read_ns, latched_ns;
+
+#if !LS7366R_SPIDEV
+    printf("bench_spi: needs the spidev backend, skipped\n");
+    return 0;
+#endif
+    if (initLS7336RChip(SPI0_CE0) < 0 || initLS7336RChip(SPI0_CE1) < 0) {
+        printf("bench_spi: failed to open the mock spidev devices\n");
+        return 1;
+    }
+    resetLS7336RStats();
+
+    read_ns = time_reads();
+    getLS7336RStats(&stats);
+    latched_ns = time_latched();
+
+    printf("bench_spi: %u reads, %u errors\n", stats.reads, stats.errors);
+    printf("bench_spi: driver %.0f ns per read (max %.1f us), latched pair %.0f ns\n",
+        read_ns, stats.max_ns / 1000.0, latched_ns);
+    printf("bench_spi: plus %.1f us on the wire per read at %u Hz\n",
+        wire_us, (unsigned)LS7366R_SPI_SPEED);
+    return stats.errors == 0 ? 0 : 1;
+}
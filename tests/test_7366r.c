@@ -0,0 +1,132 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         test_7366r.c
+*
+* Description:
+*   Tests for unwrapping narrow LS7366R counter reads into 64 bit counts,
+*   and for the counter width chosen from the sample rate. Run by
+*   make test.
+******************************************************************************/
+
+#include <stdio.h>
+#include "7366rDriver.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/**
+ * The counter value a chip Bytes wide shows for an unwrapped count.
+ */
+static unsigned raw_count(long long count, int bytes)
+{
+    return (unsigned)((unsigned long long)count & ((1ull << (8 * bytes)) - 1));
+}
+
+/**
+ * Steps of just under half the range, up then down, across many wraps,
+ * starting either side of zero.
+ */
+static void test_unwrap_steps(int bytes)
+{
+    long long half = (long long)(1ull << (8 * bytes)) / 2;
+    long long starts[] = { 0, -5, 3 * half + 7 };
+
+    for (unsigned s = 0; s < sizeof(starts) / sizeof(starts[0]); s++) {
+        long long count = starts[s];
+        long long unwrapped = count;
+
+        for (int i = 0; i < 20; i++) {
+            count += half - 1;
+            unwrapped = unwrapLS7336RCount(unwrapped, raw_count(count, bytes), bytes);
+            CHECK(unwrapped == count);
+        }
+        for (int i = 0; i < 40; i++) {
+            count -= half;
+            unwrapped = unwrapLS7336RCount(unwrapped, raw_count(count, bytes), bytes);
+            CHECK(unwrapped == count);
+        }
+    }
+}
+
+/**
+ * A step of exactly half the range can't be told apart from the same step
+ * the other way, it is taken as backwards. Anything smaller unwraps.
+ */
+static void test_unwrap_limit(int bytes)
+{
+    long long half = (long long)(1ull << (8 * bytes)) / 2;
+    long long previous = 1000;
+
+    CHECK(unwrapLS7336RCount(previous, raw_count(previous + half - 1, bytes), bytes) == previous + half - 1);
+    CHECK(unwrapLS7336RCount(previous, raw_count(previous - half + 1, bytes), bytes) == previous - half + 1);
+    CHECK(unwrapLS7336RCount(previous, raw_count(previous - half, bytes), bytes) == previous - half);
+    CHECK(unwrapLS7336RCount(previous, raw_count(previous + half, bytes), bytes) == previous - half);
+    CHECK(unwrapLS7336RCount(previous, raw_count(previous, bytes), bytes) == previous);
+}
+
+/**
+ * Wrapping across the top of the counter and below zero.
+ */
+static void test_unwrap_wrap(int bytes)
+{
+    long long range = (long long)(1ull << (8 * bytes));
+
+    CHECK(unwrapLS7336RCount(range - 2, 1, bytes) == range + 1);
+    CHECK(unwrapLS7336RCount(range + 1, (unsigned)(range - 2), bytes) == range - 2);
+    CHECK(unwrapLS7336RCount(1, (unsigned)(range - 2), bytes) == -2);
+    CHECK(unwrapLS7336RCount(-2, 1, bytes) == 1);
+}
+
+/**
+ * The chosen width must survive LS7366R_MISSED_READS late reads at full
+ * speed, and be the narrowest that does.
+ */
+static void test_choose_bytes(void)
+{
+    double rates[] = { 10.0, 50.0, 200.0, 1000.0, 10000.0 };
+    double revs[] = { 0.5, 5.0, 50.0, 500.0 };
+
+    for (unsigned r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        for (unsigned v = 0; v < sizeof(revs) / sizeof(revs[0]); v++) {
+            double moved = revs[v] * PULSES_PER_REV / rates[r] * (LS7366R_MISSED_READS + 1);
+            int bytes = chooseLS7336RCounterBytes(rates[r], revs[v]);
+
+            CHECK(bytes >= 1 && bytes <= 4);
+            if (bytes < 4) {
+                CHECK(moved < (double)(1ull << (8 * bytes)) / 2.0);
+            }
+            if (bytes > 1) {
+                CHECK(moved >= (double)(1ull << (8 * (bytes - 1))) / 2.0);
+            }
+        }
+    }
+    CHECK(chooseLS7336RCounterBytes(200.0, 5.0) == 2);
+}
+
+int main(void)
+{
+    for (int bytes = 1; bytes <= 4; bytes++) {
+        test_unwrap_steps(bytes);
+        test_unwrap_limit(bytes);
+        test_unwrap_wrap(bytes);
+    }
+    test_choose_bytes();
+
+    printf("test_7366r: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,166 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         test_line_estimator.c
+*
+* Description:
+*   Tests for the line position estimator: the offset from the front
+*   sensors and its interpolation between crossings, the heading from
+*   the rear pair, and holding the line on its last side when it is
+*   lost. Run by make test.
+******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include "LineEstimator.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define NEAR(a, b) (fabsf((a) - (b)) < 1e-4f)
+
+#define MS(t) ((uint64_t)(t) * 1000000ull)
+
+#define FL (1u << LINE_FRONT_LEFT)
+#define FC (1u << LINE_FRONT_CENTER)
+#define FR (1u << LINE_FRONT_RIGHT)
+#define RL (1u << LINE_REAR_LEFT)
+#define RR (1u << LINE_REAR_RIGHT)
+
+/**
+ * A first sighting puts the line at the centroid of the front sensors
+ * which see it.
+ */
+static void test_offset(void)
+{
+    LineEstimate est;
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FC, MS(1000));
+    CHECK(!est.lost);
+    CHECK(NEAR(est.offset_cm, 0.0f));
+    CHECK(NEAR(est.heading_rad, 0.0f));
+    CHECK(NEAR(est.error, 0.0f));
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FR, MS(1000));
+    CHECK(NEAR(est.offset_cm, LINE_FRONT_SPACING_CM));
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FL | FC, MS(1000));
+    CHECK(NEAR(est.offset_cm, -LINE_FRONT_SPACING_CM / 2.0f));
+    CHECK(est.error < 0.0f);
+}
+
+/**
+ * When the right sensor turns on, the line is at the left edge of its
+ * reach. It carries on at the speed it crossed at, but no further than
+ * the pattern allows.
+ */
+static void test_crossing(void)
+{
+    LineEstimate est;
+    float edge = LINE_FRONT_SPACING_CM - LINE_DETECT_WIDTH_CM / 2.0f;
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FC, MS(1000));
+    LineEstimator_Update(&est, FC | FR, MS(1100));
+    CHECK(NEAR(est.offset_cm, edge));
+    CHECK(NEAR(est.rate_cm_s, edge / 0.1f));
+
+    LineEstimator_Update(&est, FC | FR, MS(1150));
+    CHECK(NEAR(est.offset_cm, edge + est.rate_cm_s * 0.05f));
+
+    /* Held at the right edge of the center sensor's reach */
+    LineEstimator_Update(&est, FC | FR, MS(1400));
+    CHECK(NEAR(est.offset_cm, LINE_DETECT_WIDTH_CM / 2.0f));
+
+    /* Crossings too far apart give no speed */
+    LineEstimator_Update(&est, FR, MS(2000));
+    CHECK(NEAR(est.rate_cm_s, 0.0f));
+}
+
+/**
+ * The rear pair gives the offset further back, and with the front
+ * offset the heading of the line.
+ */
+static void test_rear_pair(void)
+{
+    LineEstimate est;
+    float heading = atan2f(LINE_REAR_OFFSET_CM, LINE_SENSOR_BASE_CM);
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FC | RL, MS(1000));
+    CHECK(NEAR(est.offset_cm, 0.0f));
+    CHECK(NEAR(est.heading_rad, heading));
+    CHECK(NEAR(est.error, LINE_HEADING_GAIN_CM * heading));
+
+    LineEstimator_Update(&est, FC | RR, MS(1010));
+    CHECK(NEAR(est.heading_rad, -heading));
+
+    /* Neither or both rear sensors: the line is centered at the rear */
+    LineEstimator_Update(&est, FC | RL | RR, MS(1020));
+    CHECK(NEAR(est.heading_rad, 0.0f));
+    LineEstimator_Update(&est, FC, MS(1030));
+    CHECK(NEAR(est.heading_rad, 0.0f));
+}
+
+/**
+ * A lost line is held just beyond the outer sensor on the side it was
+ * last seen, and found again from scratch.
+ */
+static void test_lost(void)
+{
+    LineEstimate est;
+
+    LineEstimator_Init(&est);
+    LineEstimator_Update(&est, FR, MS(1000));
+    LineEstimator_Update(&est, 0, MS(1010));
+    CHECK(est.lost);
+    CHECK(NEAR(est.offset_cm, LINE_LOST_OFFSET_CM));
+    CHECK(NEAR(est.rate_cm_s, 0.0f));
+
+    LineEstimator_Update(&est, FL, MS(1020));
+    CHECK(!est.lost);
+    CHECK(NEAR(est.offset_cm, -LINE_FRONT_SPACING_CM));
+    LineEstimator_Update(&est, 0, MS(1030));
+    CHECK(est.lost);
+    CHECK(NEAR(est.offset_cm, -LINE_LOST_OFFSET_CM));
+
+    /* Only the rear pair sees it: still lost, held on the same side */
+    LineEstimator_Update(&est, RR, MS(1040));
+    CHECK(est.lost);
+    CHECK(NEAR(est.offset_cm, -LINE_LOST_OFFSET_CM));
+
+    /* The outer pair without the center is a crossing line, the last
+     * offset is kept */
+    LineEstimator_Update(&est, FC, MS(1050));
+    LineEstimator_Update(&est, FL | FR, MS(1060));
+    CHECK(!est.lost);
+    CHECK(NEAR(est.offset_cm, 0.0f));
+}
+
+int main(void)
+{
+    test_offset();
+    test_crossing();
+    test_rear_pair();
+    test_lost();
+
+    printf("test_line_estimator: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         test_sonar_crosstalk.c
+*
+* Description:
+*   Runs the sonar scheduler against fake pigpio echoes. A sonar range
+*   gated short of its echo stops listening before the echo ends, and the
+*   end of that echo lands in the other sonar's window, which must be
+*   counted as crosstalk. With every echo inside its window none is.
+*   Run by make test.
+******************************************************************************/
+
+#include <stdio.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <pigpio.h>
+#include "sonar.h"
+#include "Timing.h"
+
+#define TEST_RUN_US     500000
+#define ECHO_DELAY_US   300
+
+#define PIN_TRIG_A      16
+#define PIN_ECHO_A      12
+#define PIN_TRIG_B      21
+#define PIN_ECHO_B      20
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static gpioAlertFuncEx_t alert_funcs[32];
+static void* alert_args[32];
+static unsigned echo_us[32];    /* Echo width for each echo pin */
+
+/* pigpio, faked: a trigger starts a thread which raises and lowers the
+ * echo pin of the same sonar */
+
+uint32_t gpioTick(void)
+{
+    return (uint32_t)(Timing_NowNs() / TIMING_NS_PER_US);
+}
+
+int gpioSetAlertFuncEx(unsigned user_gpio, gpioAlertFuncEx_t f, void* userdata)
+{
+    alert_funcs[user_gpio] = f;
+    alert_args[user_gpio] = userdata;
+    return 0;
+}
+
+/**
+ * Call the alert for an edge on pin, as pigpio would, unless the alert
+ * has been cancelled.
+ */
+static void fake_edge(unsigned pin, int level)
+{
+    gpioAlertFuncEx_t f = alert_funcs[pin];
+
+    if (f != NULL) {
+        f(pin, level, gpioTick(), alert_args[pin]);
+    }
+}
+
+static void* fake_echo(void* ptr)
+{
+    unsigned pin = (unsigned)(long)ptr;
+
+    usleep(ECHO_DELAY_US);
+    fake_edge(pin, 1);
+    usleep(echo_us[pin]);
+    fake_edge(pin, 0);
+    return NULL;
+}
+
+int gpioTrigger(unsigned user_gpio, unsigned pulseLen, unsigned level)
+{
+    pthread_t thread;
+    unsigned pin = user_gpio == PIN_TRIG_A ? PIN_ECHO_A : PIN_ECHO_B;
+
+    if (pthread_create(&thread, NULL, fake_echo, (void*)(long)pin) != 0) {
+        return -1;
+    }
+    pthread_detach(thread);
+    return 0;
+}
+
+int gpioRead(unsigned gpio)
+{
+    return 0;
+}
+
+uint32_t gpioRead_Bits_0_31(void)
+{
+    return 0;
+}
+
+int gpioGlitchFilter(unsigned user_gpio, unsigned steady)
+{
+    return 0;
+}
+
+static bool terminate;
+
+static void* stop_after_run(void* ptr)
+{
+    usleep(TEST_RUN_US);
+    terminate = true;
+    return NULL;
+}
+
+/**
+ * Ping sonars A and B until TEST_RUN_US has passed, with B gated to
+ * b_range_cm.
+ */
+static void run_pair(SonarArgs* a, SonarArgs* b, float b_range_cm)
+{
+    SonarArgs* sonars[] = { a, b };
+    SonarSchedulerArgs sched;
+    pthread_t stopper;
+
+    terminate = false;
+    init_SonarArgs(a, 0, PIN_TRIG_A, PIN_ECHO_A);
+    init_SonarArgs(b, 1, PIN_TRIG_B, PIN_ECHO_B);
+    set_sonar_range(b, b_range_cm);
+    a->p_terminate = &terminate;
+    b->p_terminate = &terminate;
+    init_SonarSchedulerArgs(&sched, sonars, 2);
+    sched.p_terminate = &terminate;
+
+    pthread_create(&stopper, NULL, stop_after_run, NULL);
+    run_sonar_scheduler(&sched);
+    pthread_join(stopper, NULL);
+    /* Let the last echoes finish before the next run */
+    usleep(2 * SONAR_ECHO_WAIT_US);
+}
+
+/**
+ * B listens out to 20 cm but its echo comes from about 6 m away, and
+ * ends while A, pinged next, is listening.
+ */
+static void test_overheard(void)
+{
+    SonarArgs a, b;
+
+    echo_us[PIN_ECHO_A] = 12000;
+    echo_us[PIN_ECHO_B] = 34000;
+    run_pair(&a, &b, 20.0f);
+
+    CHECK(b.stats.late_echoes > 0);
+    CHECK(a.stats.crosstalk > 0);
+    CHECK(b.stats.crosstalk == 0);
+}
+
+/**
+ * Echoes which end inside their own windows are never crosstalk.
+ */
+static void test_quiet(void)
+{
+    SonarArgs a, b;
+
+    echo_us[PIN_ECHO_A] = 2000;
+    echo_us[PIN_ECHO_B] = 3000;
+    run_pair(&a, &b, SONAR_MAX_DISTANCE_CM);
+
+    CHECK(a.stats.echoes > 0 && b.stats.echoes > 0);
+    CHECK(a.stats.crosstalk == 0);
+    CHECK(b.stats.crosstalk == 0);
+}
+
+int main(void)
+{
+    test_overheard();
+    test_quiet();
+
+    printf("test_sonar_crosstalk: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
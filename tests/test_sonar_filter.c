@@ -0,0 +1,153 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         test_sonar_filter.c
+*
+* Description:
+*   Tests for the sonar range filter: the median rejecting a single bad
+*   echo, a jump in range gated until a second echo confirms it, the
+*   track widening through dropouts and being dropped, and how many
+*   echoes a new track needs before it is trusted. Run by make test.
+******************************************************************************/
+
+#include <math.h>
+#include <stdio.h>
+#include "sonar.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+#define PING_NS     50000000ull     /* 20 Hz */
+#define MAX_RANGE   300.0f
+
+static uint64_t now_ns;
+
+/**
+ * Feed one ping to the filter, PING_NS after the last.
+ */
+static void ping(SonarRangeFilter* filter, bool valid, float range_cm)
+{
+    now_ns += PING_NS;
+    sonar_filter_update(filter, valid, range_cm, now_ns);
+}
+
+/**
+ * A filter tracking an object standing still at range_cm.
+ */
+static void settle(SonarRangeFilter* filter, float range_cm)
+{
+    now_ns = 1000 * PING_NS;
+    sonar_filter_init(filter, MAX_RANGE);
+    for (int i = 0; i < 10; i++) {
+        ping(filter, true, range_cm);
+    }
+}
+
+static void test_outlier(void)
+{
+    SonarRangeFilter filter;
+
+    settle(&filter, 100.0f);
+    ping(&filter, true, 30.0f);
+    CHECK(filter.tracking);
+    CHECK(!filter.gated);
+    CHECK(fabsf(filter.range_cm - 100.0f) < 0.5f);
+    ping(&filter, true, 100.0f);
+    CHECK(fabsf(filter.range_cm - 100.0f) < 0.5f);
+    CHECK(filter.restarts == 1);
+}
+
+static void test_gated_jump(void)
+{
+    SonarRangeFilter filter;
+
+    settle(&filter, 100.0f);
+
+    /* The first far echo is outvoted by the median */
+    ping(&filter, true, 200.0f);
+    CHECK(!filter.gated);
+    CHECK(fabsf(filter.range_cm - 100.0f) < 0.5f);
+
+    /* Now the median jumps, too far from the track to update it */
+    ping(&filter, true, 200.0f);
+    CHECK(filter.gated);
+    CHECK(filter.gated_cm == 200.0f);
+    CHECK(fabsf(filter.range_cm - 100.0f) < 0.5f);
+    CHECK(filter.restarts == 1);
+
+    /* A second median which agrees restarts the track there */
+    ping(&filter, true, 200.0f);
+    CHECK(!filter.gated);
+    CHECK(filter.restarts == 2);
+    CHECK(filter.range_cm == 200.0f);
+    CHECK(filter.rate_cm_s == 0.0f);
+}
+
+static void test_dropouts(void)
+{
+    SonarRangeFilter filter;
+    float var_cm2;
+
+    settle(&filter, 100.0f);
+    var_cm2 = filter.cov[0][0];
+
+    for (int i = 1; i < SONAR_DROPOUT_LIMIT; i++) {
+        ping(&filter, false, 0.0f);
+        CHECK(filter.tracking);
+        CHECK(filter.dropouts == i);
+        CHECK(filter.cov[0][0] > var_cm2);
+        var_cm2 = filter.cov[0][0];
+    }
+    ping(&filter, false, 0.0f);
+    CHECK(!filter.tracking);
+    CHECK(filter.lost == 1);
+
+    /* The next echo starts a fresh track */
+    ping(&filter, true, 120.0f);
+    CHECK(filter.tracking);
+    CHECK(filter.range_cm == 120.0f);
+    CHECK(filter.restarts == 2);
+}
+
+static void test_trust(void)
+{
+    SonarRangeFilter filter;
+
+    now_ns = 1000 * PING_NS;
+    sonar_filter_init(&filter, MAX_RANGE);
+
+    /* One echo alone is never trusted */
+    ping(&filter, true, 80.0f);
+    CHECK(filter.tracking);
+    CHECK(filter.cov[0][0] > SONAR_TRUST_VAR_CM2);
+
+    /* A second one which agrees is */
+    ping(&filter, true, 80.0f);
+    CHECK(filter.cov[0][0] <= SONAR_TRUST_VAR_CM2);
+    CHECK(fabsf(filter.range_cm - 80.0f) < 0.5f);
+}
+
+int main(void)
+{
+    test_outlier();
+    test_gated_jump();
+    test_dropouts();
+    test_trust();
+
+    printf("test_sonar_filter: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+/******************************************************************************
+* Class:        CSC-615-01 Spring 2023
+*
+* Names:        Zachary Colbert
+*               Sajan Gurung
+*               Robert Swanson
+*               Tyler Wartzok
+*
+* Github ID:    ttwartzok
+* Project:      Final Project - Self Driving Car
+*
+* File:         test_timing.c
+*
+* Description:
+*   Tests for the timing helpers: pigpio tick arithmetic across the 2^32 us
+*   wrap, fixed-rate periods which fall behind, and converting deadlines
+*   to CLOCK_REALTIME. The monotonic clock is replaced with a fake one.
+*   Run by make test.
+******************************************************************************/
+
+#include <stdio.h>
+#include "Timing.h"
+
+static int failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static uint64_t fake_now_ns;
+
+static uint64_t fake_clock(void)
+{
+    return fake_now_ns;
+}
+
+static void test_tick_wrap(void)
+{
+    CHECK(Timing_TickDiff(5u, 0xFFFFFFF0u) == 21);
+    CHECK(Timing_TickDiff(0xFFFFFFF0u, 5u) == -21);
+    CHECK(Timing_TickDiff(0u, 0xFFFFFFFFu) == 1);
+    CHECK(Timing_TickDiff(0x7FFFFFFFu, 0u) == 0x7FFFFFFF);
+    CHECK(Timing_TickDiff(123u, 123u) == 0);
+
+    CHECK(Timing_TickBefore(0xFFFFFFF0u, 5u));
+    CHECK(!Timing_TickBefore(5u, 0xFFFFFFF0u));
+    CHECK(Timing_TickBefore(0xFFFFFFFFu, 0u));
+    CHECK(!Timing_TickBefore(7u, 7u));
+}
+
+static void test_tick_to_ns(void)
+{
+    uint64_t now_ns = 5000000000ull;
+
+    /* Tick taken 21 us before the wrap was read after it */
+    CHECK(Timing_TickToNs(0xFFFFFFF0u, 5u, now_ns) == now_ns - 21000);
+    /* And a tick just after the wrap, read before the wrap */
+    CHECK(Timing_TickToNs(5u, 0xFFFFFFF0u, now_ns) == now_ns + 21000);
+    CHECK(Timing_TickToNs(1000u, 1000u, now_ns) == now_ns);
+}
+
+static void test_next_period(void)
+{
+    uint64_t next = 0;
+
+    Timing_SetClock(fake_clock);
+
+    /* On time */
+    fake_now_ns = 50;
+    CHECK(Timing_NextPeriod(&next, 100) == 0);
+    CHECK(next == 100);
+
+    /* Woke at 455, the wakeups at 200, 300 and 400 were missed */
+    fake_now_ns = 455;
+    CHECK(Timing_NextPeriod(&next, 100) == 3);
+    CHECK(next == 500);
+
+    /* Exactly on a period boundary, that period counts as missed */
+    fake_now_ns = 600;
+    CHECK(Timing_NextPeriod(&next, 100) == 1);
+    CHECK(next == 700);
+
+    /* Just before the next wakeup */
+    fake_now_ns = 699;
+    CHECK(Timing_NextPeriod(&next, 100) == 0);
+    CHECK(next == 800);
+
+    Timing_SetClock(NULL);
+}
+
+static void test_deadline(void)
+{
+    uint64_t deadline;
+
+    Timing_SetClock(fake_clock);
+    fake_now_ns = 999999999;
+    deadline = Timing_Deadline(10);
+    fake_now_ns = 1000000008;
+    CHECK(!Timing_Expired(deadline));
+    fake_now_ns = 1000000009;
+    CHECK(Timing_Expired(deadline));
+    Timing_SetClock(NULL);
+}
+
+static void test_timespec(void)
+{
+    struct timespec ts;
+
+    Timing_NsTimespec(1999999999ull, &ts);
+    CHECK(ts.tv_sec == 1 && ts.tv_nsec == 999999999);
+    Timing_NsTimespec(2000000000ull, &ts);
+    CHECK(ts.tv_sec == 2 && ts.tv_nsec == 0);
+    CHECK(Timing_TimespecNs(&ts) == 2000000000ull);
+}
+
+/**
+ * A deadline whose remaining time carries the wall clock's tv_nsec past
+ * one second must come out normalised, in the right second.
+ */
+static void test_realtime_deadline(void)
+{
+    struct timespec before, after, ts;
+    uint64_t remaining, ns;
+
+    Timing_SetClock(fake_clock);
+    fake_now_ns = 10 * TIMING_NS_PER_S;
+
+    clock_gettime(CLOCK_REALTIME, &before);
+    remaining = TIMING_NS_PER_S - (uint64_t)before.tv_nsec + 500 * TIMING_NS_PER_US;
+    Timing_RealtimeDeadline(fake_now_ns + remaining, &ts);
+    clock_gettime(CLOCK_REALTIME, &after);
+
+    ns = Timing_TimespecNs(&ts);
+    CHECK(ts.tv_nsec >= 0 && ts.tv_nsec < (long)TIMING_NS_PER_S);
+    CHECK(ts.tv_sec >= before.tv_sec + 1);
+    CHECK(ns >= Timing_TimespecNs(&before) + remaining);
+    CHECK(ns <= Timing_TimespecNs(&after) + remaining);
+
+    /* A deadline already passed is now */
+    clock_gettime(CLOCK_REALTIME, &before);
+    Timing_RealtimeDeadline(fake_now_ns - 1, &ts);
+    clock_gettime(CLOCK_REALTIME, &after);
+    ns = Timing_TimespecNs(&ts);
+    CHECK(ns >= Timing_TimespecNs(&before) && ns <= Timing_TimespecNs(&after));
+
+    Timing_SetClock(NULL);
+}
+
+int main(void)
+{
+    test_tick_wrap();
+    test_tick_to_ns();
+    test_next_period();
+    test_deadline();
+    test_timespec();
+    test_realtime_deadline();
+
+    printf("test_timing: %s\n", failures ? "FAILED" : "ok");
+    return failures ? 1 : 0;
+}